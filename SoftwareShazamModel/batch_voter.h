@@ -0,0 +1,155 @@
+/*
+ * Batch queries: votes many samples in one pass over the index.
+ *
+ * The fingerprints of all samples are sorted by key and merged with the
+ * sorted keys of the index, so every posting list a sample needs is
+ * decoded once, in index order, and its hits are scattered to per sample
+ * hit lists. Each list is then voted into one offset_voter, so only one set
+ * of histograms is live. Offline jobs identifying many samples get one
+ * sequential scan of the index instead of a random probe per fingerprint,
+ * which is what counts once the mapped index no longer fits in memory.
+ *
+ * The matches are the same as an offset_voter's for each sample alone.
+ * BATCH_SAMPLES samples are merged per pass, which bounds the hit lists
+ * held at once to 8 bytes per hit of that many samples.
+ */
+
+#ifndef _BATCH_VOTER_H
+#define _BATCH_VOTER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "shazam.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+#include "offset_voter.h"
+
+#ifndef BATCH_SAMPLES
+#define BATCH_SAMPLES 8
+#endif
+
+class batch_voter {
+public:
+	batch_voter(unsigned min_anchor_votes = VOTE_ANCHOR_MIN,
+		unsigned tolerance = VOTE_TOLERANCE)
+		: min_anchor_votes(min_anchor_votes),
+		voter(min_anchor_votes, tolerance), hits(BATCH_SAMPLES) {}
+
+	/* Writes the matches of samples[i] to out[i] */
+	void vote(const std::vector<std::vector<fingerprint_record> > & samples,
+		const fingerprint_index & database,
+		std::vector<std::vector<offset_match> > & out)
+	{
+		out.resize(samples.size());
+		for (size_t first = 0; first < samples.size(); first += BATCH_SAMPLES) {
+			size_t last = std::min(samples.size(), first + (size_t) BATCH_SAMPLES);
+			vote_pass(samples, first, last, database);
+			for (size_t s = first; s < last; s++) {
+				voter.reset();
+				if (min_anchor_votes <= 1)
+					vote_offsets(hits[s - first]);
+				else
+					vote_anchors(hits[s - first]);
+				voter.matches(out[s]);
+			}
+		}
+	}
+
+private:
+	struct query {
+		fingerprint_key key;
+		uint16_t time;
+		uint16_t sample;
+	};
+
+	static bool query_less(const query & a, const query & b)
+	{
+		if (a.key != b.key)
+			return a.key < b.key;
+		if (a.sample != b.sample)
+			return a.sample < b.sample;
+		return a.time < b.time;
+	}
+
+	void vote_pass(const std::vector<std::vector<fingerprint_record> > & samples,
+		size_t first, size_t last, const fingerprint_index & database)
+	{
+		queries.clear();
+		for (size_t s = first; s < last; s++) {
+			hits[s - first].clear();
+			for (size_t i = 0; i < samples[s].size(); i++) {
+				query q = {samples[s][i].hash, samples[s][i].time,
+					(uint16_t) (s - first)};
+				queries.push_back(q);
+			}
+		}
+		std::sort(queries.begin(), queries.end(), query_less);
+
+		size_t k = 0;
+		size_t keys = database.unique_keys();
+		for (size_t q = 0, r; q < queries.size() && k < keys; q = r) {
+			fingerprint_key key = queries[q].key;
+			for (r = q; r < queries.size() && queries[r].key == key; r++)
+				;
+			while (k < keys && database.key_at(k) < key)
+				k++;
+			if (k == keys || database.key_at(k) != key)
+				continue;
+
+			posting_span span = database.postings_at(k);
+			postings.clear();
+			for (auto it = span.begin(); it != span.end(); ++it)
+				postings.push_back(*it);
+			for (size_t i = q; i < r; i++)
+				scatter(queries[i]);
+		}
+	}
+
+	/*
+	 * Appends the hits of q to its sample's list: (song, offset) for plain
+	 * voting, or (anchor time, song, db time) for the target zone rule,
+	 * whose anchors are only complete once every key has been seen.
+	 */
+	void scatter(const query & q)
+	{
+		std::vector<uint64_t> & h = hits[q.sample];
+		if (min_anchor_votes <= 1) {
+			for (size_t p = 0; p < postings.size(); p++)
+				h.push_back((uint32_t) postings[p].song_ID << 16
+					| (uint16_t) (postings[p].time_pt - q.time));
+		} else {
+			for (size_t p = 0; p < postings.size(); p++)
+				h.push_back((uint64_t) q.time << 32
+					| (uint32_t) postings[p].song_ID << 16 | postings[p].time_pt);
+		}
+	}
+
+	void vote_offsets(const std::vector<uint64_t> & h)
+	{
+		for (size_t i = 0; i < h.size(); i++)
+			voter.add((uint16_t) (h[i] >> 16), (uint16_t) h[i], 1);
+	}
+
+	/* The target zone rule of offset_voter::vote */
+	void vote_anchors(std::vector<uint64_t> & h)
+	{
+		std::sort(h.begin(), h.end());
+		for (size_t i = 0, j; i < h.size(); i = j) {
+			for (j = i; j < h.size() && h[j] == h[i]; j++)
+				;
+			if (j - i >= min_anchor_votes)
+				voter.add((uint16_t) (h[i] >> 16), (uint16_t) h[i]
+					- (uint16_t) (h[i] >> 32), j - i);
+		}
+	}
+
+	unsigned min_anchor_votes;
+	offset_voter voter;
+	std::vector<std::vector<uint64_t> > hits;
+	std::vector<query> queries;
+	std::vector<song_data> postings;
+};
+
+#endif
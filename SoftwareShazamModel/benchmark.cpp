@@ -0,0 +1,1176 @@
+/*
+ * Throughput benchmarks for the recognition pipeline.
+ *
+ * Usage:
+ *   benchmark stft <file.wav>
+ *   benchmark peaks <file.wav>
+ *   benchmark fingerprints <file.wav>
+ *   benchmark index <constellation dir>
+ *   benchmark identify <constellation dir>
+ *   benchmark threads <constellation dir>
+ *   benchmark batch <constellation dir>
+ *   benchmark topk <constellation dir>
+ *   benchmark live <constellation dir>
+ *   benchmark progressive <constellation dir>
+ *   benchmark locate <constellation dir>
+ *   benchmark scan <constellation dir>
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <new>
+#include <malloc.h>
+#include <unordered_map>
+#include <algorithm>
+#include <random>
+#include "shazam.h"
+#include "spectrogram.h"
+#include "constellation.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+#include "offset_voter.h"
+#include "batch_voter.h"
+#include "query_context.h"
+#include "sliding_voter.h"
+#include "scanner.h"
+#include "stft.h"
+
+/* Live heap bytes, for the memory figures */
+static size_t heap_live = 0;
+
+void * operator new(size_t size)
+{
+	void * p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	heap_live += malloc_usable_size(p);
+	return p;
+}
+
+/* out of line, or GCC flags the free() as mismatched with new */
+__attribute__((noinline))
+void operator delete(void * p) noexcept
+{
+	if (p)
+		heap_live -= malloc_usable_size(p);
+	free(p);
+}
+
+bool match_equal(const offset_match & a, const offset_match & b)
+{
+	return a.song_ID == b.song_ID && a.offset == b.offset && a.votes == b.votes;
+}
+
+double now_seconds()
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Times the in-process STFT against the fft.py path, i.e. generateFFT
+ * writing the text spectrograms and read_fft parsing them back.
+ */
+int bench_stft(const std::string & wav_file, const std::string & script_dir)
+{
+	std::vector<float> signal;
+	std::vector<float> mag;
+	std::vector<float> real;
+	uint32_t sample_rate;
+	size_t frames = 0;
+	double start;
+	double elapsed;
+	int reps = 0;
+
+	if (!read_wav(wav_file, signal, sample_rate))
+		return 1;
+
+	start = now_seconds();
+	do {
+		frames = compute_stft(signal, NFFT, &mag, &real);
+		reps++;
+		elapsed = now_seconds() - start;
+	} while (elapsed < 1.0);
+	std::cout << "C++ STFT:    " << frames << " frames, "
+		<< frames * reps / elapsed << " frames/sec" << std::endl;
+
+	/* fft.py writes <name>.mag/.real into the working directory */
+	std::string dir = wav_file.substr(0, wav_file.find_last_of('/') + 1);
+	std::string name = wav_file.substr(dir.size());
+	std::string base = name.substr(0, name.size() - 4);
+	std::string cmd = "PYTHONPATH=\"" + script_dir + "\" python3 -c "
+		"'import sys, fft; fft.generateFFT(sys.argv[1], sys.argv[2], "
+		+ std::to_string(NFFT) + ")' \"" + dir + "\" \"" + name + "\" > /dev/null";
+
+	start = now_seconds();
+	if (system(cmd.c_str()) != 0) {
+		std::cout << "Python path: fft.py failed (needs numpy/scipy/matplotlib)"
+			<< std::endl;
+		return 0;
+	}
+	double python_elapsed = now_seconds() - start;
+
+	std::vector<float> text_frames;
+	start = now_seconds();
+	long text_count = parse_text_spectrogram(base + ".mag", NFFT/2, text_frames);
+	text_count = parse_text_spectrogram(base + ".real", NFFT/2, text_frames);
+	double parse_elapsed = now_seconds() - start;
+
+	std::cout << "Python path: " << text_count << " frames, "
+		<< text_count / python_elapsed << " frames/sec (fft.py), "
+		<< text_count / (python_elapsed + parse_elapsed)
+		<< " frames/sec including text parsing" << std::endl;
+	std::cout << "Speedup:     " << (python_elapsed + parse_elapsed)
+		/ (elapsed / reps) << "x" << std::endl;
+	return 0;
+}
+
+/*
+ * Times the two peak picking strategies on the magnitude spectrogram of a
+ * WAV file. The prune_in_time path runs the pruner directly so the
+ * per-band statistics prune_in_time prints don't end up in the timing.
+ */
+int bench_peaks(const std::string & wav_file)
+{
+	std::vector<float> signal;
+	std::vector<float> mag;
+	uint32_t sample_rate;
+	size_t peaks = 0;
+	double start;
+	double elapsed;
+	int reps;
+
+	if (!read_wav(wav_file, signal, sample_rate))
+		return 1;
+	size_t frames = compute_stft(signal, NFFT, &mag, NULL);
+	spectrogram fft(SPECTROGRAM_WIDTH, frames);
+	for (size_t t = 0; t < frames; t++)
+		fft.push_frame(&mag[t * (NFFT/2)]);
+
+	reps = 0;
+	start = now_seconds();
+	do {
+		peak_pruner pruner;
+		std::vector<peak> pruned;
+		std::list<peak_raw> raw = get_raw_peaks(fft, NFFT);
+		for (auto it = raw.cbegin(); it != raw.cend(); ++it)
+			pruner.push(*it, pruned);
+		pruner.flush(pruned);
+		peaks = pruned.size();
+		reps++;
+		elapsed = now_seconds() - start;
+	} while (elapsed < 1.0);
+	std::cout << "prune_in_time: " << peaks << " peaks, "
+		<< frames * reps / elapsed << " frames/sec" << std::endl;
+
+	reps = 0;
+	start = now_seconds();
+	do {
+		peaks = max_bins(fft, NFFT).size();
+		reps++;
+		elapsed = now_seconds() - start;
+	} while (elapsed < 1.0);
+	std::cout << "max_bins:      " << peaks << " peaks, "
+		<< frames * reps / elapsed << " frames/sec" << std::endl;
+	return 0;
+}
+
+/*
+ * Times fingerprint generation on the constellation of a WAV file, reusing
+ * one output buffer the way a recognizer would.
+ */
+int bench_fingerprints(const std::string & wav_file)
+{
+	std::vector<float> signal;
+	std::vector<float> mag;
+	std::vector<fingerprint_record> prints;
+	uint32_t sample_rate;
+	double start;
+	double elapsed;
+	int reps = 0;
+
+	if (!read_wav(wav_file, signal, sample_rate))
+		return 1;
+	size_t frames = compute_stft(signal, NFFT, &mag, NULL);
+	spectrogram fft(SPECTROGRAM_WIDTH, frames);
+	for (size_t t = 0; t < frames; t++)
+		fft.push_frame(&mag[t * (NFFT/2)]);
+	std::vector<peak> peaks = generate_constellation_map(fft, NFFT);
+
+	start = now_seconds();
+	do {
+		generate_fingerprints(peaks, prints);
+		reps++;
+		elapsed = now_seconds() - start;
+	} while (elapsed < 1.0);
+	std::cout << "Fingerprints: " << peaks.size() << " peaks, "
+		<< prints.size() << " fingerprints, "
+		<< prints.size() * reps / elapsed << " fingerprints/sec" << std::endl;
+	return 0;
+}
+
+/*
+ * Reads the fingerprints of the songs in dir/song_list.txt from their
+ * constellations, and those of their _NOISY samples. Returns the total
+ * number of song fingerprints.
+ */
+size_t read_catalog(const std::string & dir,
+	std::vector<std::vector<fingerprint_record> > & songs,
+	std::vector<std::vector<fingerprint_record> > & samples)
+{
+	std::vector<fingerprint_record> prints;
+	std::vector<peak> peaks;
+	std::fstream file;
+	std::string line;
+	size_t total = 0;
+
+	file.open((dir + "/song_list.txt").c_str());
+	while (getline(file, line)) {
+		if (line.empty())
+			continue;
+		read_peak_file(dir + "/" + line + "_48.magpeak", peaks);
+		generate_fingerprints(peaks, prints);
+		songs.push_back(prints);
+		total += prints.size();
+		read_peak_file(dir + "/" + line + "_NOISY_48.magpeak", peaks);
+		generate_fingerprints(peaks, prints);
+		samples.push_back(prints);
+	}
+	file.close();
+	if (!total)
+		std::cerr << "no constellations in " << dir << std::endl;
+	return total;
+}
+
+/*
+ * Builds the database of the songs in dir/song_list.txt from their
+ * constellations, both as the old unordered_multimap and as a
+ * fingerprint_index, and looks up the fingerprints of the _NOISY samples
+ * in each.
+ */
+int bench_index(const std::string & dir)
+{
+	std::vector<std::vector<fingerprint_record> > songs;
+	std::vector<std::vector<fingerprint_record> > samples;
+	std::vector<fingerprint_record> queries;
+	size_t hits = 0;
+	size_t heap_before;
+	double start;
+	double elapsed;
+	int reps;
+
+	size_t total = read_catalog(dir, songs, samples);
+	if (!total)
+		return 1;
+	for (size_t s = 0; s < samples.size(); s++)
+		queries.insert(queries.end(), samples[s].begin(), samples[s].end());
+	std::cout << songs.size() << " songs, " << total << " fingerprints, "
+		<< queries.size() << " queries" << std::endl;
+
+	{
+		heap_before = heap_live;
+		std::unordered_multimap<fingerprint_key, song_data> db;
+		for (size_t s = 0; s < songs.size(); s++) {
+			for (size_t i = 0; i < songs[s].size(); i++) {
+				song_data value = {songs[s][i].time, (uint16_t) (s + 1)};
+				db.insert(std::make_pair(songs[s][i].hash, value));
+			}
+		}
+		double bytes = heap_live - heap_before;
+
+		reps = 0;
+		start = now_seconds();
+		do {
+			for (size_t q = 0; q < queries.size(); q++) {
+				auto range = db.equal_range(queries[q].hash);
+				for (auto it = range.first; it != range.second; ++it)
+					hits += it->second.time_pt;
+			}
+			reps++;
+			elapsed = now_seconds() - start;
+		} while (elapsed < 1.0);
+		std::cout << "unordered_multimap: " << bytes / total << " bytes/fingerprint, "
+			<< queries.size() * reps / elapsed << " lookups/sec" << std::endl;
+	}
+
+	{
+		heap_before = heap_live;
+		fingerprint_index db;
+		for (size_t s = 0; s < songs.size(); s++)
+			db.add(songs[s], s + 1);
+		db.build();
+		double bytes = heap_live - heap_before;
+
+		reps = 0;
+		start = now_seconds();
+		do {
+			for (size_t q = 0; q < queries.size(); q++) {
+				posting_span span = db.lookup(queries[q].hash);
+				for (auto it = span.begin(); it != span.end(); ++it)
+					hits += it->time_pt;
+			}
+			reps++;
+			elapsed = now_seconds() - start;
+		} while (elapsed < 1.0);
+		std::cout << "fingerprint_index:  " << bytes / total << " bytes/fingerprint, "
+			<< queries.size() * reps / elapsed << " lookups/sec" << std::endl;
+
+		/* every posting list once, so mostly decoding */
+		std::vector<fingerprint_key> keys;
+		for (size_t s = 0; s < songs.size(); s++)
+			for (size_t i = 0; i < songs[s].size(); i++)
+				keys.push_back(songs[s][i].hash);
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+		reps = 0;
+		start = now_seconds();
+		do {
+			for (size_t k = 0; k < keys.size(); k++) {
+				posting_span span = db.lookup(keys[k]);
+				for (auto it = span.begin(); it != span.end(); ++it)
+					hits += it->time_pt;
+			}
+			reps++;
+			elapsed = now_seconds() - start;
+		} while (elapsed < 1.0);
+		std::cout << "postings: " << db.posting_bytes() << " bytes, "
+			<< (double) db.posting_bytes() / db.size() << " bytes/posting, "
+			<< "compression " << (double) (db.size() * sizeof(song_data))
+				/ db.posting_bytes() << "x, "
+			<< db.size() * reps / elapsed << " decoded/sec" << std::endl;
+	}
+
+	/* keeps the lookups from being optimized out */
+	return hits == 1 ? 1 : 0;
+}
+
+/*
+ * Identifies the _NOISY samples of the songs in dir against their
+ * database, voting with the old per query hash map of (song, db time,
+ * sample time) counts and with offset_voter.
+ */
+int bench_identify(const std::string & dir)
+{
+	std::vector<std::vector<fingerprint_record> > songs;
+	std::vector<std::vector<fingerprint_record> > samples;
+	std::vector<offset_match> matches;
+	fingerprint_index db;
+	offset_voter voter;
+	size_t prints = 0;
+	size_t correct;
+	double start;
+	double elapsed;
+	int reps;
+
+	if (!read_catalog(dir, songs, samples))
+		return 1;
+	for (size_t s = 0; s < songs.size(); s++) {
+		db.add(songs[s], s + 1);
+		prints += samples[s].size();
+	}
+	db.build();
+	std::cout << samples.size() << " samples, " << prints << " fingerprints"
+		<< std::endl;
+
+	reps = 0;
+	start = now_seconds();
+	do {
+		correct = 0;
+		for (size_t s = 0; s < samples.size(); s++) {
+			std::unordered_map<uint64_t, uint8_t> db2;
+			std::vector<int> count(songs.size() + 1, 0);
+			for (size_t i = 0; i < samples[s].size(); i++) {
+				posting_span span = db.lookup(samples[s][i].hash);
+				for (auto it = span.begin(); it != span.end(); ++it)
+					db2[(uint64_t) it->song_ID << 32
+						| (uint64_t) it->time_pt << 16
+						| samples[s][i].time]++;
+			}
+			for (auto it = db2.begin(); it != db2.end(); ++it)
+				if (it->second >= T_ZONE)
+					count[it->first >> 32] += it->second;
+			correct += std::max_element(count.begin(), count.end())
+				- count.begin() == (long) s + 1;
+		}
+		reps++;
+		elapsed = now_seconds() - start;
+	} while (elapsed < 1.0);
+	std::cout << "hash map:     " << correct << " correct, "
+		<< samples.size() * reps / elapsed << " samples/sec" << std::endl;
+
+	reps = 0;
+	start = now_seconds();
+	do {
+		correct = 0;
+		for (size_t s = 0; s < samples.size(); s++) {
+			voter.reset();
+			voter.vote(samples[s], db);
+			voter.matches(matches);
+			uint16_t best = 0;
+			uint32_t votes = 0;
+			for (size_t m = 0; m < matches.size(); m++) {
+				if (matches[m].votes > votes) {
+					votes = matches[m].votes;
+					best = matches[m].song_ID;
+				}
+			}
+			correct += best == s + 1;
+		}
+		reps++;
+		elapsed = now_seconds() - start;
+	} while (elapsed < 1.0);
+	std::cout << "offset_voter: " << correct << " correct, "
+		<< samples.size() * reps / elapsed << " samples/sec" << std::endl;
+	return 0;
+}
+
+/*
+ * Strong scaling of parallel_voter on the _NOISY samples of the songs in
+ * dir: the same samples with 1, 2, 4... threads, checking that every
+ * thread count gives the single threaded matches.
+ */
+int bench_threads(const std::string & dir)
+{
+	std::vector<std::vector<fingerprint_record> > songs;
+	std::vector<std::vector<fingerprint_record> > samples;
+	std::vector<std::vector<offset_match> > expected;
+	std::vector<offset_match> matches;
+	fingerprint_index db;
+	double single = 0;
+	double start;
+	double elapsed;
+	int reps;
+
+	if (!read_catalog(dir, songs, samples))
+		return 1;
+	for (size_t s = 0; s < songs.size(); s++)
+		db.add(songs[s], s + 1);
+	db.build();
+
+	{
+		parallel_voter voter(1);
+		for (size_t s = 0; s < samples.size(); s++) {
+			voter.vote(samples[s], db, matches);
+			expected.push_back(matches);
+		}
+	}
+
+	unsigned hardware = std::thread::hardware_concurrency();
+	std::cout << samples.size() << " samples, " << hardware
+		<< " hardware threads" << std::endl;
+	for (unsigned threads = 1; threads <= std::max(hardware, 8u); threads *= 2) {
+		parallel_voter voter(threads);
+		bool same = true;
+		reps = 0;
+		start = now_seconds();
+		do {
+			for (size_t s = 0; s < samples.size(); s++) {
+				voter.vote(samples[s], db, matches);
+				same = same && matches.size() == expected[s].size()
+					&& std::equal(matches.begin(), matches.end(),
+						expected[s].begin(), match_equal);
+			}
+			reps++;
+			elapsed = now_seconds() - start;
+		} while (elapsed < 1.0);
+		double rate = samples.size() * reps / elapsed;
+		if (threads == 1)
+			single = rate;
+		std::cout << threads << " threads: " << rate << " samples/sec, speedup "
+			<< rate / single << ", efficiency " << rate / single / threads
+			<< (same ? "" : ", MATCHES DIFFER") << std::endl;
+		if (!same)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Identifies the _NOISY samples of the songs in dir one offset_voter query
+ * at a time and as one batch_voter batch, checking that both give the
+ * same matches, with plain and with target zone voting.
+ */
+int bench_batch(const std::string & dir)
+{
+	std::vector<std::vector<fingerprint_record> > songs;
+	std::vector<std::vector<fingerprint_record> > samples;
+	std::vector<std::vector<offset_match> > expected;
+	std::vector<std::vector<offset_match> > batched;
+	fingerprint_index db;
+	double start;
+	double elapsed;
+	int reps;
+
+	if (!read_catalog(dir, songs, samples))
+		return 1;
+	for (size_t s = 0; s < songs.size(); s++)
+		db.add(songs[s], s + 1);
+	db.build();
+	expected.resize(samples.size());
+	std::cout << samples.size() << " samples" << std::endl;
+
+	unsigned anchor_min[] = {VOTE_ANCHOR_MIN, T_ZONE};
+	for (int mode = 0; mode < 2; mode++) {
+		offset_voter voter(anchor_min[mode]);
+		batch_voter batch(anchor_min[mode]);
+		std::cout << "anchor min " << anchor_min[mode] << ":" << std::endl;
+
+		reps = 0;
+		start = now_seconds();
+		do {
+			for (size_t s = 0; s < samples.size(); s++) {
+				voter.reset();
+				voter.vote(samples[s], db);
+				voter.matches(expected[s]);
+			}
+			reps++;
+			elapsed = now_seconds() - start;
+		} while (elapsed < 1.0);
+		std::cout << "  per sample: " << samples.size() * reps / elapsed
+			<< " samples/sec" << std::endl;
+
+		reps = 0;
+		start = now_seconds();
+		do {
+			batch.vote(samples, db, batched);
+			reps++;
+			elapsed = now_seconds() - start;
+		} while (elapsed < 1.0);
+		bool same = true;
+		for (size_t s = 0; s < samples.size(); s++)
+			same = same && batched[s].size() == expected[s].size()
+				&& std::equal(batched[s].begin(), batched[s].end(),
+					expected[s].begin(), match_equal);
+		std::cout << "  batched:    " << samples.size() * reps / elapsed
+			<< " samples/sec" << (same ? "" : ", MATCHES DIFFER") << std::endl;
+		if (!same)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Identifies the _NOISY samples of the songs in dir with a full
+ * query_context ranking and with identify_top, which stops once the
+ * leader is far enough ahead, and reports how much of the samples that took.
+ */
+int bench_topk(const std::string & dir)
+{
+	std::vector<std::vector<fingerprint_record> > songs;
+	std::vector<std::vector<fingerprint_record> > samples;
+	std::list<database_info> song_list;
+	fingerprint_index db;
+	size_t prints = 0;
+	size_t consumed;
+	size_t correct;
+	bool same;
+	double start;
+	double elapsed;
+	int reps;
+
+	if (!read_catalog(dir, songs, samples))
+		return 1;
+	for (size_t s = 0; s < songs.size(); s++) {
+		db.add(songs[s], s + 1);
+		struct database_info info = {std::to_string(s + 1), (uint16_t) (s + 1),
+			(int) songs[s].size()};
+		song_list.push_back(info);
+		prints += samples[s].size();
+	}
+	db.build();
+	query_context query(song_list);
+	std::cout << samples.size() << " samples, " << prints << " fingerprints"
+		<< std::endl;
+
+	std::vector<uint32_t> full_votes;
+	reps = 0;
+	start = now_seconds();
+	do {
+		correct = 0;
+		full_votes.clear();
+		for (size_t s = 0; s < samples.size(); s++) {
+			const count_ID * best = query.identify(samples[s], db)[0];
+			correct += best->song == std::to_string(s + 1);
+			full_votes.push_back(best->count);
+		}
+		reps++;
+		elapsed = now_seconds() - start;
+	} while (elapsed < 1.0);
+	std::cout << "full ranking: " << correct << " correct, "
+		<< samples.size() * reps / elapsed << " samples/sec" << std::endl;
+
+	reps = 0;
+	start = now_seconds();
+	do {
+		correct = 0;
+		consumed = 0;
+		same = true;
+		for (size_t s = 0; s < samples.size(); s++) {
+			const top_result & top = query.identify_top(samples[s], db);
+			correct += top.leaders[0].song_ID == s + 1;
+			consumed += top.consumed;
+			same = same && (top.consumed < samples[s].size()
+				|| top.leaders[0].votes == full_votes[s]);
+		}
+		reps++;
+		elapsed = now_seconds() - start;
+	} while (elapsed < 1.0);
+	std::cout << "identify_top: " << correct << " correct, "
+		<< samples.size() * reps / elapsed << " samples/sec, "
+		<< 100.0 * consumed / prints << "% of fingerprints voted"
+		<< (same ? "" : ", VOTES DIFFER") << std::endl;
+	return same ? 0 : 1;
+}
+
+/*
+ * Plays the _NOISY samples of the songs in dir back to back as one stream
+ * and identifies the last LIVE_WINDOW frames every LIVE_HOP frames, with a
+ * sliding_voter fed as the stream goes and with an offset_voter voting
+ * each window from scratch, checking that both find the same leader.
+ */
+#define LIVE_WINDOW 2500
+#define LIVE_HOP 250
+
+int bench_live(const std::string & dir)
+{
+	std::vector<std::vector<fingerprint_record> > songs;
+	std::vector<std::vector<fingerprint_record> > samples;
+	std::vector<peak> stream;
+	std::vector<uint32_t> stream_time;	/* by stream peak, unwrapped */
+	std::vector<uint16_t> stream_song;
+	std::vector<fingerprint_record> all;
+	std::vector<fingerprint_record> prints;
+	std::vector<offset_match> live_leaders;
+	std::vector<offset_match> scratch_leaders;
+	std::vector<peak> peaks;
+	std::fstream file;
+	std::string line;
+	fingerprint_index db;
+	uint32_t shift = 0;
+	uint16_t song_ID = 0;
+
+	if (!read_catalog(dir, songs, samples))
+		return 1;
+	for (size_t s = 0; s < songs.size(); s++)
+		db.add(songs[s], s + 1);
+	db.build();
+
+	file.open((dir + "/song_list.txt").c_str());
+	while (getline(file, line)) {
+		if (line.empty())
+			continue;
+		song_ID++;
+		read_peak_file(dir + "/" + line + "_NOISY_48.magpeak", peaks);
+		for (size_t i = 0; i < peaks.size(); i++) {
+			/* 16 bit times wrap, as they do on the board */
+			peak p = {peaks[i].freq, (uint16_t) (peaks[i].time + shift)};
+			stream.push_back(p);
+			stream_time.push_back(peaks[i].time + shift);
+			stream_song.push_back(song_ID);
+		}
+		shift += peaks.empty() ? 0 : peaks.back().time + 1;
+	}
+	file.close();
+	generate_fingerprints(stream, all);
+	std::cout << songs.size() << " samples, " << shift << " frames, window "
+		<< LIVE_WINDOW << " frames, every " << LIVE_HOP << std::endl;
+
+	sliding_voter live(LIVE_WINDOW);
+	offset_voter scratch;
+	fingerprint_stream stream_prints;
+	live.reserve(songs.size(), songs.size());
+	scratch.reserve(songs.size(), songs.size());
+	double live_elapsed = 0;
+	double scratch_elapsed = 0;
+	double start;
+	size_t voted = 0;
+	size_t window_prints = 0;
+	size_t reports = 0;
+	size_t whole = 0;
+	size_t correct = 0;
+	bool same = true;
+
+	for (uint32_t end = LIVE_HOP, next = 0; next < stream.size(); end += LIVE_HOP) {
+		size_t first = next;
+		while (next < stream.size() && stream_time[next] < end)
+			next++;
+		stream_prints.push(&stream[first], next - first, prints);
+		same = same && std::equal(prints.begin(), prints.end(), all.begin() + voted,
+			[](const fingerprint_record & a, const fingerprint_record & b)
+			{ return a.hash == b.hash && a.time == b.time; });
+
+		start = now_seconds();
+		live.push(prints, db);
+		live.leaders(2, live_leaders);
+		live_elapsed += now_seconds() - start;
+		voted += prints.size();
+		if (!voted)
+			continue;
+
+		/* the same window, voted from scratch */
+		start = now_seconds();
+		uint16_t newest = all[voted - 1].time;
+		size_t from = voted;
+		while (from > 0 && (uint16_t) (newest - all[from - 1].time) < LIVE_WINDOW)
+			from--;
+		scratch.reset();
+		scratch.vote(&all[from], voted - from, db);
+		scratch.leaders(2, scratch_leaders);
+		scratch_elapsed += now_seconds() - start;
+
+		reports++;
+		window_prints += live.fingerprints();
+		same = same && live.fingerprints() == voted - from
+			&& live_leaders.size() == scratch_leaders.size();
+		for (size_t i = 0; same && i < live_leaders.size(); i++)
+			same = live_leaders[i].song_ID == scratch_leaders[i].song_ID
+				&& live_leaders[i].votes == scratch_leaders[i].votes
+				&& live_leaders[i].offset == scratch_leaders[i].offset;
+
+		/* windows inside one sample should find its song */
+		uint16_t song = stream_song[(voted - 1) / T_ZONE];
+		if (stream_song[from / T_ZONE] == song) {
+			whole++;
+			correct += !live_leaders.empty() && live_leaders[0].song_ID == song;
+		}
+	}
+
+	std::cout << reports << " reports, " << window_prints / reports
+		<< " fingerprints per window" << std::endl;
+	std::cout << "sliding: " << 1e6 * live_elapsed / reports << " us per report, "
+		<< correct << "/" << whole << " single-sample windows correct" << std::endl;
+	std::cout << "scratch: " << 1e6 * scratch_elapsed / reports << " us per report"
+		<< (same ? ", same leaders" : ", LEADERS DIFFER") << std::endl;
+	return same ? 0 : 1;
+}
+
+/*
+ * Identifies the _NOISY samples of the songs in dir as if they were being
+ * recorded: the peaks of each pruning window are fingerprinted and voted
+ * when the window would close, until the leader is ANSWER_CONFIDENCE
+ * ahead, and reports how much of the samples that took and how often the
+ * early answer was right.
+ */
+int bench_progressive(const std::string & dir)
+{
+	std::vector<std::vector<fingerprint_record> > songs;
+	std::vector<std::vector<fingerprint_record> > samples;
+	std::list<database_info> song_list;
+	std::vector<fingerprint_record> prints;
+	std::vector<uint32_t> answer_frames;
+	std::vector<peak> peaks;
+	fingerprint_stream stream;
+	std::fstream file;
+	std::string line;
+	fingerprint_index db;
+	size_t answered = 0;
+	size_t correct = 0;
+	size_t fallback_correct = 0;
+	uint64_t frames = 0;
+	uint16_t song_ID = 0;
+
+	if (!read_catalog(dir, songs, samples))
+		return 1;
+	for (size_t s = 0; s < songs.size(); s++) {
+		db.add(songs[s], s + 1);
+		struct database_info info = {std::to_string(s + 1), (uint16_t) (s + 1),
+			(int) songs[s].size()};
+		song_list.push_back(info);
+	}
+	db.build();
+	query_context query(song_list);
+
+	file.open((dir + "/song_list.txt").c_str());
+	while (getline(file, line)) {
+		if (line.empty())
+			continue;
+		song_ID++;
+		read_peak_file(dir + "/" + line + "_NOISY_48.magpeak", peaks);
+		if (peaks.empty())
+			continue;
+		uint32_t length = peaks.back().time + 1;
+		frames += length;
+
+		stream.reset();
+		query.begin();
+		const top_result * top = NULL;
+		size_t next = 0;
+		uint32_t end;
+		for (end = PRUNING_TIME_WINDOW; next < peaks.size(); end += PRUNING_TIME_WINDOW) {
+			size_t first = next;
+			while (next < peaks.size() && peaks[next].time < end)
+				next++;
+			stream.push(&peaks[first], next - first, prints);
+			top = &query.add(prints, db);
+			if (top->answered())
+				break;
+		}
+		if (top->answered()) {
+			answered++;
+			correct += top->leaders[0].song_ID == song_ID;
+			answer_frames.push_back(std::min(end, length));
+		} else {
+			fallback_correct += top->leaders[0].song_ID == song_ID;
+		}
+	}
+	file.close();
+
+	std::sort(answer_frames.begin(), answer_frames.end());
+	uint64_t answer_total = 0;
+	for (size_t i = 0; i < answer_frames.size(); i++)
+		answer_total += answer_frames[i];
+	std::cout << song_ID << " samples, " << frames / song_ID
+		<< " frames each, confidence " << ANSWER_CONFIDENCE << std::endl;
+	std::cout << "early: " << answered << " answered, " << correct << " correct";
+	if (answered)
+		std::cout << ", median " << answer_frames[answered / 2] << " frames, "
+			<< 100.0 * answer_total / frames << "% of the audio";
+	std::cout << std::endl;
+	std::cout << "full recording: " << song_ID - answered << " samples, "
+		<< fallback_correct << " correct" << std::endl;
+	return 0;
+}
+
+/*
+ * Cuts a sample out of each song in dir at a known frame, and checks that
+ * the best offset query_context finds for it is that frame, give or take
+ * the voting tolerance.
+ */
+#define LOCATE_FRAMES 2500
+
+int bench_locate(const std::string & dir)
+{
+	std::vector<std::vector<fingerprint_record> > songs;
+	std::vector<std::vector<fingerprint_record> > samples;
+	std::list<database_info> song_list;
+	std::vector<peak> peaks;
+	std::vector<peak> cut;
+	std::vector<fingerprint_record> prints;
+	std::fstream file;
+	std::string line;
+	fingerprint_index db;
+	uint16_t song_ID = 0;
+	size_t located = 0;
+	uint32_t worst = 0;
+
+	if (!read_catalog(dir, songs, samples))
+		return 1;
+	for (size_t s = 0; s < songs.size(); s++) {
+		db.add(songs[s], s + 1);
+		struct database_info info = {std::to_string(s + 1), (uint16_t) (s + 1),
+			(int) songs[s].size()};
+		song_list.push_back(info);
+	}
+	db.build();
+	query_context query(song_list);
+
+	file.open((dir + "/song_list.txt").c_str());
+	while (getline(file, line)) {
+		if (line.empty())
+			continue;
+		song_ID++;
+		read_peak_file(dir + "/" + line + "_48.magpeak", peaks);
+		if (peaks.empty())
+			continue;
+		/* somewhere different in every song */
+		uint32_t length = peaks.back().time + 1;
+		uint32_t start = length > LOCATE_FRAMES
+			? (song_ID * 7919u) % (length - LOCATE_FRAMES) : 0;
+		cut.clear();
+		for (size_t i = 0; i < peaks.size(); i++) {
+			if (peaks[i].time >= start && peaks[i].time < start + LOCATE_FRAMES) {
+				peak p = {peaks[i].freq, (uint16_t) (peaks[i].time - start)};
+				cut.push_back(p);
+			}
+		}
+		generate_fingerprints(cut, prints);
+
+		const count_ID & best = *query.identify(prints, db)[0];
+		uint32_t error = std::abs((int) best.offset - (int) start);
+		if (best.song == std::to_string(song_ID) && error <= VOTE_TOLERANCE)
+			located++;
+		worst = std::max(worst, error);
+	}
+	file.close();
+
+	std::cout << located << "/" << song_ID << " samples of " << LOCATE_FRAMES
+		<< " frames (" << frames_to_seconds(LOCATE_FRAMES) << " s) located, worst "
+		<< worst << " frames (" << frames_to_seconds(worst) << " s) off" << std::endl;
+	return located == song_ID ? 0 : 1;
+}
+
+/*
+ * Scans a made-up broadcast of SCAN_BROADCAST_HOURS hours: excerpts of
+ * the songs in dir, from anywhere in them, with a third of their peaks
+ * lost and a third as many random peaks added, between stretches of random
+ * peaks alone. Reports how many excerpts were found, what else was, how
+ * far the ends found are from the true ones, the throughput on one thread
+ * and on all of them, and the scanner's memory for half the broadcast and
+ * for all of it. Peak picking is not timed; scan times the whole pipeline.
+ */
+#define SCAN_BROADCAST_HOURS 3
+#define SCAN_EXCERPT_MIN 20	/* seconds */
+#define SCAN_EXCERPT_MAX 120
+#define SCAN_GAP_MAX 60
+
+struct broadcast_excerpt {
+	uint16_t song_ID;
+	uint16_t song_start;
+	uint64_t start;
+	uint64_t end;
+};
+
+/* Scans part of a broadcast's peaks as scan does, a pruning window at a time */
+void scan_broadcast(const std::vector<peak> & peaks, const std::vector<uint64_t> & times,
+	const scan_part & part, const fingerprint_index & db, size_t songs,
+	std::vector<occurrence> & found, size_t * memory)
+{
+	size_t base = heap_live;
+	stream_scanner scanner;
+	fingerprint_stream stream;
+	std::vector<fingerprint_record> prints;
+	std::vector<peak> window;
+
+	scanner.reserve(songs, songs);
+	scanner.begin(part.origin, part.first, part.last);
+	size_t next = std::lower_bound(times.begin(), times.end(), part.origin) - times.begin();
+	uint64_t end = part.last + SCAN_TAIL;
+	for (uint64_t to = part.origin; to < end; ) {
+		to = std::min(to + PRUNING_TIME_WINDOW, end);
+		window.clear();
+		for (; next < times.size() && times[next] < to; next++) {
+			peak p = {peaks[next].freq, (uint16_t) (times[next] - part.origin)};
+			window.push_back(p);
+		}
+		stream.push(window, prints);
+		scanner.push(prints, db, to - 1);
+		if (memory)
+			*memory = std::max(*memory, heap_live - base);
+	}
+	scanner.finish();
+	found = scanner.occurrences();
+}
+
+bool occurrence_equal(const occurrence & a, const occurrence & b)
+{
+	return a.song_ID == b.song_ID && a.song_start == b.song_start
+		&& a.votes == b.votes && a.start == b.start && a.end == b.end;
+}
+
+int bench_scan(const std::string & dir)
+{
+	std::vector<std::vector<peak> > songs;
+	std::vector<std::vector<fingerprint_record> > prints;
+	std::vector<broadcast_excerpt> excerpts;
+	std::vector<std::pair<uint64_t, uint16_t> > segment;	/* time, freq */
+	std::vector<peak> peaks;
+	std::vector<uint64_t> times;
+	std::fstream file;
+	std::string line;
+	fingerprint_index db;
+	std::mt19937 rng(1);
+	uint64_t song_frames = 0;
+	size_t song_peaks = 0;
+
+	file.open((dir + "/song_list.txt").c_str());
+	while (getline(file, line)) {
+		if (line.empty())
+			continue;
+		songs.push_back(std::vector<peak>());
+		read_peak_file(dir + "/" + line + "_48.magpeak", songs.back());
+		prints.push_back(std::vector<fingerprint_record>());
+		generate_fingerprints(songs.back(), prints.back());
+		db.add(prints.back(), songs.size());
+		song_peaks += songs.back().size();
+		song_frames += songs.back().empty() ? 0 : songs.back().back().time + 1;
+	}
+	file.close();
+	if (!song_peaks) {
+		std::cerr << "no constellations in " << dir << std::endl;
+		return 1;
+	}
+	db.build();
+
+	/* the broadcast, with peaks as dense as the songs' */
+	double frame_rate = (double) SAMPLING_FREQ / FRAME_HOP;
+	double density = (double) song_peaks / song_frames;
+	uint64_t frames = 0;
+	auto noise = [&](uint64_t from, uint64_t to, double per_frame) {
+		std::bernoulli_distribution hit(per_frame);
+		for (uint64_t t = from; t < to; t++)
+			if (hit(rng))
+				segment.push_back(std::make_pair(t, 1 + rng() % (BIN6 - 1)));
+	};
+	while (frames < SCAN_BROADCAST_HOURS * 3600 * frame_rate) {
+		uint64_t gap = rng() % 4 ? rng() % (uint64_t) (SCAN_GAP_MAX * frame_rate) : 0;
+		uint16_t s = rng() % songs.size();
+		uint32_t length = songs[s].empty() ? 0 : songs[s].back().time + 1;
+		uint32_t excerpt = std::min(length, (uint32_t) (frame_rate
+			* (SCAN_EXCERPT_MIN + rng() % (SCAN_EXCERPT_MAX - SCAN_EXCERPT_MIN))));
+		uint32_t from = rng() % (length - excerpt + 1);
+
+		segment.clear();
+		noise(frames, frames + gap + excerpt, density / 3);
+		for (size_t i = 0; i < songs[s].size(); i++)
+			if (songs[s][i].time >= from && songs[s][i].time < from + excerpt
+				&& rng() % 3)
+				segment.push_back(std::make_pair(frames + gap
+					+ songs[s][i].time - from, songs[s][i].freq));
+		std::sort(segment.begin(), segment.end());
+		for (size_t i = 0; i < segment.size(); i++) {
+			peak p = {segment[i].second, (uint16_t) segment[i].first};
+			peaks.push_back(p);
+			times.push_back(segment[i].first);
+		}
+		broadcast_excerpt e = {(uint16_t) (s + 1), (uint16_t) from,
+			frames + gap, frames + gap + excerpt - 1};
+		excerpts.push_back(e);
+		frames += gap + excerpt;
+	}
+	std::cout << excerpts.size() << " excerpts of " << songs.size() << " songs in "
+		<< frames / frame_rate / 3600 << " h, " << peaks.size() << " peaks" << std::endl;
+
+	/* one thread, then one per hardware thread */
+	std::vector<scan_part> parts;
+	std::vector<occurrence> found;
+	size_t memory = 0;
+	plan_scan(frames, 1, parts);
+	double start = now_seconds();
+	scan_broadcast(peaks, times, parts[0], db, songs.size(), found, &memory);
+	double single = now_seconds() - start;
+	merge_occurrences(found);
+
+	unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+	plan_scan(frames, threads, parts);
+	std::vector<std::vector<occurrence> > part_found(parts.size());
+	std::vector<std::thread> workers;
+	start = now_seconds();
+	for (size_t p = 0; p < parts.size(); p++)
+		workers.push_back(std::thread(scan_broadcast, std::cref(peaks),
+			std::cref(times), std::cref(parts[p]), std::cref(db), songs.size(),
+			std::ref(part_found[p]), (size_t *) NULL));
+	for (size_t p = 0; p < workers.size(); p++)
+		workers[p].join();
+	double parallel = now_seconds() - start;
+	std::vector<occurrence> joined;
+	for (size_t p = 0; p < parts.size(); p++)
+		joined.insert(joined.end(), part_found[p].begin(), part_found[p].end());
+	merge_occurrences(joined);
+	bool same = joined.size() == found.size()
+		&& std::equal(found.begin(), found.end(), joined.begin(), occurrence_equal);
+
+	/* an occurrence is right if it overlaps an excerpt of its song at its alignment */
+	std::vector<char> right(found.size());
+	size_t recalled = 0;
+	double start_error = 0;
+	double end_error = 0;
+	uint64_t worst = 0;
+	for (size_t e = 0; e < excerpts.size(); e++) {
+		const broadcast_excerpt & x = excerpts[e];
+		uint16_t align = x.song_start - (uint16_t) x.start;
+		bool hit = false;
+		for (size_t i = 0; i < found.size(); i++) {
+			const occurrence & o = found[i];
+			if (o.song_ID != x.song_ID || o.start > x.end || o.end < x.start
+				|| std::abs((int16_t) ((uint16_t) (o.song_start - (uint16_t) o.start)
+					- align)) > SCAN_ALIGN)
+				continue;
+			if (!hit) {
+				uint64_t d0 = o.start > x.start ? o.start - x.start : x.start - o.start;
+				uint64_t d1 = o.end > x.end ? o.end - x.end : x.end - o.end;
+				start_error += d0;
+				end_error += d1;
+				worst = std::max(worst, std::max(d0, d1));
+			}
+			hit = true;
+			right[i] = 1;
+		}
+		recalled += hit;
+	}
+	size_t wrong = std::count(right.begin(), right.end(), 0);
+
+	size_t half_memory = 0;
+	std::vector<occurrence> half_found;
+	plan_scan(frames / 2, 1, parts);
+	scan_broadcast(peaks, times, parts[0], db, songs.size(), half_found, &half_memory);
+
+	std::cout << recalled << "/" << excerpts.size() << " excerpts found, "
+		<< wrong << " false occurrences of " << found.size() << std::endl;
+	if (recalled)
+		std::cout << "ends off by " << start_error / recalled / frame_rate
+			<< " s (start) and " << end_error / recalled / frame_rate
+			<< " s (end) on average, " << worst / frame_rate << " s at worst"
+			<< std::endl;
+	std::cout << "1 thread: " << frames / frame_rate / single << "x realtime" << std::endl;
+	std::cout << threads << " threads: " << frames / frame_rate / parallel
+		<< "x realtime, " << (same ? "same occurrences" : "OCCURRENCES DIFFER")
+		<< std::endl;
+	std::cout << "scanner memory: " << half_memory / 1024 << " KiB for half, "
+		<< memory / 1024 << " KiB for all" << std::endl;
+	return same ? 0 : 1;
+}
+
+void usage()
+{
+	std::cerr << "usage: benchmark stft <file.wav>" << std::endl;
+	std::cerr << "       benchmark peaks <file.wav>" << std::endl;
+	std::cerr << "       benchmark fingerprints <file.wav>" << std::endl;
+	std::cerr << "       benchmark index <constellation dir>" << std::endl;
+	std::cerr << "       benchmark identify <constellation dir>" << std::endl;
+	std::cerr << "       benchmark threads <constellation dir>" << std::endl;
+	std::cerr << "       benchmark batch <constellation dir>" << std::endl;
+	std::cerr << "       benchmark topk <constellation dir>" << std::endl;
+	std::cerr << "       benchmark live <constellation dir>" << std::endl;
+	std::cerr << "       benchmark progressive <constellation dir>" << std::endl;
+	std::cerr << "       benchmark locate <constellation dir>" << std::endl;
+	std::cerr << "       benchmark scan <constellation dir>" << std::endl;
+}
+
+int main(int argc, char ** argv)
+{
+	if (argc < 2) {
+		usage();
+		return 1;
+	}
+
+	/* fft.py lives next to this binary */
+	std::string self = argv[0];
+	std::string script_dir = self.find('/') == std::string::npos ? "."
+		: self.substr(0, self.find_last_of('/'));
+
+	std::string mode = argv[1];
+	if (mode == "stft" && argc == 3)
+		return bench_stft(argv[2], script_dir);
+	if (mode == "peaks" && argc == 3)
+		return bench_peaks(argv[2]);
+	if (mode == "fingerprints" && argc == 3)
+		return bench_fingerprints(argv[2]);
+	if (mode == "index" && argc == 3)
+		return bench_index(argv[2]);
+	if (mode == "identify" && argc == 3)
+		return bench_identify(argv[2]);
+	if (mode == "threads" && argc == 3)
+		return bench_threads(argv[2]);
+	if (mode == "batch" && argc == 3)
+		return bench_batch(argv[2]);
+	if (mode == "topk" && argc == 3)
+		return bench_topk(argv[2]);
+	if (mode == "live" && argc == 3)
+		return bench_live(argv[2]);
+	if (mode == "progressive" && argc == 3)
+		return bench_progressive(argv[2]);
+	if (mode == "locate" && argc == 3)
+		return bench_locate(argv[2]);
+	if (mode == "scan" && argc == 3)
+		return bench_scan(argv[2]);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,85 @@
+/*
+ * Builds the fingerprint database the recognizers map at startup (see
+ * fingerprint_index.h) from the constellation files of the songs in
+ * song_list.txt.
+ *
+ * Usage:
+ *   build_db [-s suffix] [-o file.db]
+ *
+ * Each song's constellation is read from ./<song><suffix>, the suffix
+ * defaulting to "_48.magpeak" like recognize. Song IDs follow the order of
+ * song_list.txt starting at 1. The database goes to
+ * fingerprints<suffix>.db unless -o names another file, which is where the
+ * recognizer reading that suffix looks for it:
+ *
+ *   recognize (this directory)    _48.magpeak
+ *   software/recognize            _48.realpeak
+ *   software/recognize_board      .boardpeak
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <list>
+#include <vector>
+#include "shazam.h"
+#include "constellation.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+
+int main(int argc, char ** argv)
+{
+	std::string suffix = "_48.magpeak";
+	std::string output;
+	std::list<database_info> songs;
+	std::vector<peak> peaks;
+	std::vector<fingerprint_record> prints;
+	fingerprint_index db;
+	std::fstream file;
+	std::string line;
+	uint16_t num_db = 0;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-s" && i + 1 < argc) {
+			suffix = argv[++i];
+		} else if (arg == "-o" && i + 1 < argc) {
+			output = argv[++i];
+		} else {
+			std::cerr << "usage: build_db [-s suffix] [-o file.db]" << std::endl;
+			return 1;
+		}
+	}
+	if (output.empty())
+		output = fingerprint_db_name(suffix);
+
+	file.open("song_list.txt");
+	while (getline(file, line)) {
+		if (line.empty())
+			continue;
+		num_db++;
+		if (!read_peak_file("./" + line + suffix, peaks)) {
+			std::cerr << "could not open ./" << line << suffix << std::endl;
+			return 1;
+		}
+		generate_fingerprints(peaks, prints);
+		db.add(prints, num_db);
+
+		struct database_info info;
+		info.song_name = line;
+		info.song_ID = num_db;
+		info.hash_count = prints.size();
+		songs.push_back(info);
+		std::cout << "(" << num_db << ") " << line << ": "
+			<< prints.size() << " fingerprints" << std::endl;
+	}
+	file.close();
+	db.build();
+
+	if (!db.save(output, songs))
+		return 1;
+	std::cout << output << ": " << songs.size() << " songs, " << db.size()
+		<< " fingerprints, " << db.unique_keys() << " keys, "
+		<< db.bytes() << " bytes" << std::endl;
+	return 0;
+}
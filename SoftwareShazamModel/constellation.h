@@ -0,0 +1,300 @@
+/*
+ * Peak picking and pruning: spectrogram -> constellation map.
+ *
+ * generate_constellation_map keeps, for every frame, the strongest local
+ * maximum in each of the NBINS frequency bands (get_raw_peaks, using the
+ * kernels in local_max.h) and then drops the peaks that don't stand out
+ * from their band over a PRUNING_TIME_WINDOW (prune_in_time, or peak_pruner
+ * when peaks arrive incrementally). max_bins is the older per-band strategy,
+ * still selectable for comparison.
+ */
+
+#ifndef _CONSTELLATION_H
+#define _CONSTELLATION_H
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <list>
+#include <vector>
+#include "shazam.h"
+#include "spectrogram.h"
+#include "local_max.h"
+
+/*
+ * The older per-band strategy. Within each band, every local maximum counts
+ * towards the band's mean, and each frame's strongest local maximum (the
+ * lowest bin on ties) is a candidate. Candidates at or below MAX_BINS_FLOOR
+ * times the band mean are dropped, and of the rest those at least
+ * MAX_BINS_COEF times the mean of their band's candidates in the same
+ * MAX_BINS_TIME_BIN frames are kept. Peaks come out in frame order, like
+ * get_raw_peaks, and the whole pass is linear in the spectrogram size.
+ */
+inline std::vector<peak> max_bins(const spectrogram_view & fft, int nfft)
+{
+	std::vector<peak> peaks;
+	std::vector<struct peak_raw> candidates;
+	std::vector<float> bin_sum;
+	std::vector<unsigned int> bin_count;
+	const uint32_t bounds[NBINS + 1] = {BIN0, BIN1, BIN2, BIN3, BIN4, BIN5, BIN6};
+	float masked[NFFT/2];
+	float band_sum[NBINS + 1] = { };
+	unsigned int band_count[NBINS + 1] = { };
+	double band_floor[NBINS + 1] = { };
+	uint32_t size_in_freq;
+	size_t cell;
+	int bin;
+
+	size_in_freq = fft.width - 1 < BIN6 ? fft.width - 1 : BIN6;
+	for (uint32_t j = 1; j + 2 < fft.frames; j++) {
+		const float * col = fft.frame(j);
+		local_max_mask(fft.frame(j - 1), col, fft.frame(j + 1), size_in_freq, masked);
+		for (int k = 1; k <= NBINS; k++) {
+			uint32_t hi = bounds[k] < size_in_freq ? bounds[k] : size_in_freq;
+			float best = 0.0f;
+			uint32_t best_i = 0;
+			for (uint32_t i = bounds[k - 1]; i < hi; i++) {
+				if (masked[i] > 0.0f) {
+					band_sum[k] += masked[i];
+					band_count[k]++;
+					if (masked[i] > best) {
+						best = masked[i];
+						best_i = i;
+					}
+				}
+			}
+			if (best > 0.0f) {
+				struct peak_raw p = {best, (uint16_t) best_i, (uint16_t) j};
+				candidates.push_back(p);
+			}
+		}
+	}
+
+	for (int k = 1; k <= NBINS; k++) {
+		if (band_count[k])
+			band_floor[k] = MAX_BINS_FLOOR * (band_sum[k] / band_count[k]);
+	}
+
+	/* one cell per (time bin, band) */
+	bin_sum.assign((fft.frames / MAX_BINS_TIME_BIN + 1) * (NBINS + 1), 0.0f);
+	bin_count.assign(bin_sum.size(), 0);
+	for (size_t c = 0; c < candidates.size(); c++) {
+		bin = freq_to_bin(candidates[c].freq);
+		if (candidates[c].ampl > band_floor[bin]) {
+			cell = candidates[c].time / MAX_BINS_TIME_BIN * (NBINS + 1) + bin;
+			bin_sum[cell] += candidates[c].ampl;
+			bin_count[cell]++;
+		}
+	}
+	for (size_t c = 0; c < candidates.size(); c++) {
+		bin = freq_to_bin(candidates[c].freq);
+		cell = candidates[c].time / MAX_BINS_TIME_BIN * (NBINS + 1) + bin;
+		if (candidates[c].ampl > band_floor[bin] && candidates[c].ampl
+				>= MAX_BINS_COEF * (bin_sum[cell] / bin_count[cell])) {
+			peaks.push_back({candidates[c].freq, candidates[c].time});
+		}
+	}
+
+	return peaks;
+}
+
+/*
+ * Appends the raw peaks of the frame col, at time, to out: the strongest
+ * local maximum of each band, against its neighbour frames prev and next.
+ * get_raw_peaks does this for every frame; a live stream can do it as the
+ * frame after col arrives.
+ */
+template <class Out>
+inline void frame_peaks(const float * prev, const float * col, const float * next,
+	uint32_t size_in_freq, uint16_t time, Out & out)
+{
+	const uint32_t bounds[NBINS + 1] = {BIN0, BIN1, BIN2, BIN3, BIN4, BIN5, BIN6};
+	float masked[NFFT/2];
+
+	local_max_mask(prev, col, next, size_in_freq, masked);
+	for (int k = 1; k <= NBINS; k++) {
+		uint32_t hi = bounds[k] < size_in_freq ? bounds[k] : size_in_freq;
+		int i = bounds[k - 1] < hi ? band_peak(masked, bounds[k - 1], hi) : -1;
+		if (i >= 0) {
+			struct peak_raw p = {col[i], (uint16_t) i, time};
+			out.push_back(p);
+		}
+	}
+}
+
+// Eitan's re-write:
+
+inline std::list<peak_raw> get_raw_peaks(const spectrogram_view & fft, int nfft)
+{
+    std::list<peak_raw> peaks;
+    uint32_t size_in_time;
+    uint32_t size_in_freq;
+
+    size_in_time = fft.frames;
+    // only bins below BIN6 belong to a band, and each needs a south neighbour
+    size_in_freq = fft.width - 1 < BIN6 ? fft.width - 1 : BIN6;
+    for(uint32_t j = 1; j + 2 < size_in_time; j++)
+	frame_peaks(fft.frame(j - 1), fft.frame(j), fft.frame(j + 1), size_in_freq,
+	    j, peaks);
+    return peaks;
+}
+
+/*
+ * Streaming form of the PRUNING_TIME_WINDOW pruning, so peaks can be pruned
+ * while audio is still arriving. Peaks are pushed in time order. The current
+ * window (times up to end_time) is held in a buffer with a running sum and
+ * count per band; the first peak past it closes the window, which computes
+ * each band's deviation over the buffer and emits the peaks that stand more
+ * than STD_DEV_COEF deviations above their band's mean. A peak is therefore
+ * emitted at most one window after it was pushed, and costs O(1) amortized.
+ *
+ * Times may wrap around 2^16, as long as peaks pushed one after another are
+ * less than 2^15 frames apart.
+ *
+ * The arithmetic is exactly that of the original batch loop, including a
+ * band's deviation carrying over into the sum of its next window, so
+ * prune_in_time is just a pruner fed the whole list.
+ */
+class peak_pruner {
+public:
+	peak_pruner()
+	{
+		window.reserve((PRUNING_TIME_WINDOW + 1) * NBINS);
+		reset();
+	}
+
+	/* Starts over, with a first window of the frames from start on */
+	void reset(uint16_t start = 0)
+	{
+		window.clear();
+		end_time = start + PRUNING_TIME_WINDOW;
+		memset(num, 0, sizeof(num));
+		memset(den, 0, sizeof(den));
+		memset(dev, 0, sizeof(dev));
+		memset(kept, 0, sizeof(kept));
+		memset(dropped, 0, sizeof(dropped));
+	}
+
+	/* Adds a peak, appending the survivors of any window it closes to out */
+	template <class Out>
+	void push(const struct peak_raw & p, Out & out)
+	{
+		if (after(p.time, end_time)) {
+			close_window(out);
+			while (after(p.time, end_time))
+				end_time += PRUNING_TIME_WINDOW;
+		}
+		int bin = freq_to_bin(p.freq);
+		den[bin]++;
+		num[bin] += p.ampl;
+		window.push_back(p);
+	}
+
+	/* Closes the current window, e.g. at the end of the audio */
+	template <class Out>
+	void flush(Out & out)
+	{
+		close_window(out);
+		end_time += PRUNING_TIME_WINDOW;
+	}
+
+	/* Peaks of band bin kept and pruned so far */
+	unsigned int kept_count(int bin) const { return kept[bin]; }
+	unsigned int pruned_count(int bin) const { return dropped[bin]; }
+
+private:
+	/* Times are 16 bit and wrap, as they do on a live stream */
+	static bool after(uint16_t a, uint16_t b) { return (int16_t) (a - b) > 0; }
+
+	template <class Out>
+	void close_window(Out & out)
+	{
+		int bin;
+
+		for (size_t k = 0; k < window.size(); k++) {
+			bin = freq_to_bin(window[k].freq);
+			// squared in double like pow() was, the float difference squares exactly
+			double diff = window[k].ampl - num[bin]/den[bin];
+			dev[bin] += diff * diff;
+		}
+		for (int i = 1; i <= NBINS; i++) {
+			if (den[i])
+				dev[i] = sqrt(dev[i]/den[i]);
+		}
+		for (size_t k = 0; k < window.size(); k++) {
+			const struct peak_raw & p = window[k];
+			bin = freq_to_bin(p.freq);
+			if (p.ampl > STD_DEV_COEF*dev[bin] + num[bin]/den[bin]) {
+				out.push_back({p.freq, p.time});
+				kept[bin]++;
+			} else {
+				dropped[bin]++;
+			}
+		}
+		window.clear();
+		memset(num, 0, sizeof(num));
+		memset(den, 0, sizeof(den));
+	}
+
+	std::vector<struct peak_raw> window;
+	uint16_t end_time;
+	float num[NBINS + 1];
+	float den[NBINS + 1];
+	float dev[NBINS + 1];
+	unsigned int kept[NBINS + 1];
+	unsigned int dropped[NBINS + 1];
+};
+
+inline std::vector<peak> prune_in_time(const std::list<peak_raw> & unpruned_peaks) {
+	peak_pruner pruner;
+	std::vector<peak> pruned_peaks;
+
+	for (auto it = unpruned_peaks.cbegin(); it != unpruned_peaks.cend(); ++it)
+		pruner.push(*it, pruned_peaks);
+	pruner.flush(pruned_peaks);
+	for (int i = 1; i <= NBINS; i++) {
+		std::cout << "bin " << i << ": " << pruner.kept_count(i) << "|  pruned: " << pruner.pruned_count(i) << std::endl;
+	}
+	return pruned_peaks;
+}
+
+/* Peak picking strategies for generate_constellation_map */
+enum peak_strategy {
+	PEAKS_PRUNE_IN_TIME,	/* get_raw_peaks, then prune_in_time */
+	PEAKS_MAX_BINS		/* max_bins */
+};
+
+inline std::vector<peak> generate_constellation_map(const spectrogram_view & fft, int nfft,
+	peak_strategy strategy = PEAKS_PRUNE_IN_TIME)
+{
+	if (strategy == PEAKS_MAX_BINS)
+		return max_bins(fft, nfft);
+
+	std::list<peak_raw> unpruned_map;
+	unpruned_map = get_raw_peaks(fft, nfft);
+	return prune_in_time(unpruned_map);
+}
+
+/*
+ * Reads a constellation file as written by write_constellation, one
+ * uint32_t per peak holding freq << 16 | time, into peaks.
+ * Returns false if the file can't be opened.
+ */
+inline bool read_peak_file(const std::string & filename, std::vector<peak> & peaks)
+{
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	uint32_t peak_32;
+
+	peaks.clear();
+	if (!fin.is_open())
+		return false;
+	while (fin.read((char *) &peak_32, sizeof(peak_32))) {
+		struct peak p = {(uint16_t) (peak_32 >> 16), (uint16_t) peak_32};
+		peaks.push_back(p);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Converts the text spectrograms written by fft.py (.mag/.real) into the
+ * binary format read by read_fft (.magspec/.realspec), see spectrogram.h.
+ *
+ * Usage:
+ *   convert_spectrogram [-r sample_rate] [file.mag file.real ...]
+ *
+ * With no files, converts every song in song_list.txt along with its
+ * _NOISY sample.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <vector>
+#include "spectrogram.h"
+
+#define NFFT 512
+#define SAMPLING_FREQ 48000
+
+bool convert(const std::string & filename, uint32_t sample_rate)
+{
+	std::vector<float> frames;
+	long count;
+
+	count = parse_text_spectrogram(filename, NFFT/2, frames);
+	if (count < 0) {
+		std::cerr << "could not open " << filename << std::endl;
+		return false;
+	}
+
+	spectrogram_header hdr = make_spectrogram_header(NFFT, NFFT/2,
+		sample_rate, NFFT/2, count);
+	if (!write_spectrogram(filename + SPECTROGRAM_EXT, hdr,
+			frames.empty() ? NULL : &frames[0]))
+		return false;
+
+	std::cout << filename << ": " << count << " frames" << std::endl;
+	return true;
+}
+
+int main(int argc, char ** argv)
+{
+	uint32_t sample_rate = SAMPLING_FREQ;
+	std::vector<std::string> files;
+	std::fstream file;
+	std::string line;
+	int failed = 0;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-r" && i + 1 < argc)
+			sample_rate = atoi(argv[++i]);
+		else
+			files.push_back(arg);
+	}
+
+	if (files.empty()) {
+		file.open("song_list.txt");
+		while(getline(file, line)){
+			if(!line.empty()){
+				files.push_back(line + ".mag");
+				files.push_back(line + ".real");
+				files.push_back(line + "_NOISY.mag");
+				files.push_back(line + "_NOISY.real");
+			}
+		}
+		file.close();
+	}
+
+	for (size_t i = 0; i < files.size(); i++) {
+		if (!convert(files[i], sample_rate))
+			failed++;
+	}
+
+	return failed ? 1 : 0;
+}
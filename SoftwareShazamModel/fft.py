@@ -66,4 +66,5 @@ def main():
         generateFFT("InputFiles/", songFile, 512)
     f.close()
 
-main()
+if __name__ == '__main__':
+    main()
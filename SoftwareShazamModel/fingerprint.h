@@ -0,0 +1,117 @@
+/*
+ * Fingerprints: hashes of pairs of constellation peaks.
+ *
+ * Every peak of a constellation is an anchor, paired with each of the
+ * T_ZONE peaks that follow it after skipping TARGET_OFFSET peaks. The hash
+ * is a 32 bit key packing, from the top, the anchor frequency and the
+ * paired frequency (HASH_FREQ_BITS each) and the time between them
+ * (HASH_DELTA_BITS, clamped). The record also keeps the anchor time, which
+ * is all matching needs besides the hash.
+ */
+
+#ifndef _FINGERPRINT_H
+#define _FINGERPRINT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "shazam.h"
+
+/* FREQ_WIDTH in Hardware/global_variables.sv */
+#ifndef HASH_FREQ_BITS
+#define HASH_FREQ_BITS 9
+#endif
+#ifndef HASH_DELTA_BITS
+#define HASH_DELTA_BITS 14
+#endif
+#define HASH_DELTA_MAX ((1u << HASH_DELTA_BITS) - 1)
+#define HASH_KEY_BITS (2 * HASH_FREQ_BITS + HASH_DELTA_BITS)
+
+typedef uint32_t fingerprint_key;
+
+static_assert(HASH_KEY_BITS <= 32,
+	"fingerprint key fields don't fit in 32 bits");
+static_assert(NFFT/2 <= 1 << HASH_FREQ_BITS,
+	"HASH_FREQ_BITS too small for NFFT");
+
+struct fingerprint_record {
+	fingerprint_key hash;
+	uint16_t time;
+};
+
+inline fingerprint_key fingerprint_hash(uint16_t anchor, uint16_t point, uint16_t delta)
+{
+	fingerprint_key d = delta < HASH_DELTA_MAX ? delta : HASH_DELTA_MAX;
+	return (fingerprint_key) anchor << (HASH_FREQ_BITS + HASH_DELTA_BITS)
+		| (fingerprint_key) point << HASH_DELTA_BITS | d;
+}
+
+/* Number of fingerprints of a constellation of `peaks` peaks */
+inline size_t fingerprint_count(size_t peaks)
+{
+	return peaks > T_ZONE + TARGET_OFFSET
+		? (peaks - T_ZONE - TARGET_OFFSET) * T_ZONE : 0;
+}
+
+/*
+ * Writes the fingerprints of count peaks, in time order, to out, replacing
+ * its contents. out only allocates when it has never held that many
+ * fingerprints, so reusing it keeps this allocation free.
+ */
+inline void generate_fingerprints(const struct peak * peaks, size_t count,
+	std::vector<fingerprint_record> & out)
+{
+	out.resize(fingerprint_count(count));
+	fingerprint_record * rec = out.empty() ? NULL : &out[0];
+
+	for (size_t a = 0; a + T_ZONE + TARGET_OFFSET < count; a++) {
+		const struct peak & anchor = peaks[a];
+		for (size_t i = 1; i <= T_ZONE; i++) {
+			const struct peak & other = peaks[a + i + TARGET_OFFSET];
+			rec->hash = fingerprint_hash(anchor.freq, other.freq,
+				other.time - anchor.time);
+			rec->time = anchor.time;
+			rec++;
+		}
+	}
+}
+
+inline void generate_fingerprints(const std::vector<peak> & peaks,
+	std::vector<fingerprint_record> & out)
+{
+	generate_fingerprints(peaks.empty() ? NULL : &peaks[0], peaks.size(), out);
+}
+
+/*
+ * Streaming form of generate_fingerprints, for a constellation that
+ * arrives a few peaks at a time. The last T_ZONE + TARGET_OFFSET peaks are
+ * held back, as they are anchors still waiting for their zone, so pushing
+ * a constellation in pieces gives the fingerprints of the whole.
+ */
+class fingerprint_stream {
+public:
+	fingerprint_stream() { held.reserve(4 * (T_ZONE + TARGET_OFFSET)); }
+
+	void reset() { held.clear(); }
+
+	/* Writes the fingerprints of the anchors count more peaks complete to out */
+	void push(const struct peak * peaks, size_t count,
+		std::vector<fingerprint_record> & out)
+	{
+		held.insert(held.end(), peaks, peaks + count);
+		generate_fingerprints(held, out);
+		size_t keep = std::min(held.size(), (size_t) (T_ZONE + TARGET_OFFSET));
+		held.erase(held.begin(), held.end() - keep);
+	}
+
+	void push(const std::vector<peak> & peaks, std::vector<fingerprint_record> & out)
+	{
+		push(peaks.empty() ? NULL : &peaks[0], peaks.size(), out);
+	}
+
+private:
+	std::vector<peak> held;
+};
+
+#endif
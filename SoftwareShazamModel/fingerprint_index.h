@@ -0,0 +1,599 @@
+/*
+ * Immutable inverted index from fingerprint keys to the (song, anchor time)
+ * pairs they occur at, in compressed sparse row form:
+ *
+ *   keys      sorted unique fingerprint keys
+ *   offsets   postings of keys[i] are bits [offsets[i], offsets[i+1]) of postings
+ *   postings  bit-packed posting lists, one per key, back to back
+ *
+ * plus a directory on the top INDEX_DIRECTORY_BITS of the key so a lookup
+ * only binary searches the few keys sharing those bits. Songs are added
+ * with add(), then build() sorts everything into place once; lookups are
+ * only valid after build() or load(). A posting is held once however often
+ * it is added, so a song added again doesn't count twice.
+ *
+ * A posting list holds the song_data entries of a key sorted by (song_ID,
+ * time_pt), each read as the 32 bit value song_ID << 16 | time_pt and
+ * stored as its difference from the previous one (the first from 0). The
+ * list starts with the delta width it uses, picked to make it smallest;
+ * deltas that don't fit, mostly where the song changes, are written as
+ * all ones followed by the full 32 bit delta. posting_iterator decodes
+ * on the fly. Bit offsets limit the postings to 512MB.
+ *
+ * save() writes the index and the song list to a database file (.db):
+ * a fixed 128 byte header followed by the directory, keys, offsets,
+ * postings and song table, each starting on a 64 byte boundary so load()
+ * can map the file and use the arrays in place. Pages are only read when
+ * a lookup touches them, and processes mapping the same file share them
+ * through the page cache.
+ */
+
+#ifndef _FINGERPRINT_INDEX_H
+#define _FINGERPRINT_INDEX_H
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shazam.h"
+#include "fingerprint.h"
+
+#ifndef INDEX_DIRECTORY_BITS
+#define INDEX_DIRECTORY_BITS 16
+#endif
+
+static_assert(INDEX_DIRECTORY_BITS <= HASH_KEY_BITS,
+	"index directory wider than the fingerprint key");
+
+#define FINGERPRINT_DB_MAGIC "FPDB"
+#define FINGERPRINT_DB_VERSION 2
+#define FINGERPRINT_DB_EXT ".db"
+#define FINGERPRINT_DB_ALIGN 64
+
+struct fingerprint_db_header {
+	char magic[4];
+	uint16_t version;
+	uint8_t freq_bits;	/* HASH_FREQ_BITS */
+	uint8_t delta_bits;	/* HASH_DELTA_BITS */
+	uint8_t directory_bits;	/* INDEX_DIRECTORY_BITS */
+	uint8_t t_zone;		/* T_ZONE */
+	uint8_t target_offset;	/* TARGET_OFFSET */
+	uint8_t reserved0;
+	uint32_t song_count;
+	uint32_t key_count;
+	uint64_t posting_count;
+	/* bytes from start of file */
+	uint64_t directory_offset;
+	uint64_t keys_offset;
+	uint64_t offsets_offset;
+	uint64_t postings_offset;
+	uint64_t songs_offset;
+	uint64_t names_offset;
+	uint64_t names_size;
+	uint64_t postings_size;	/* bytes of compressed postings */
+	uint8_t reserved[32];
+};
+
+static_assert(sizeof(fingerprint_db_header) == 128,
+	"fingerprint_db_header is part of the file format");
+
+/* Song table entry, the name is names[name_offset, name_offset + name_length) */
+struct fingerprint_db_song {
+	uint32_t name_offset;
+	uint16_t name_length;
+	uint16_t song_ID;
+	uint32_t hash_count;
+};
+
+/* Database file for constellations named <song><suffix> */
+inline std::string fingerprint_db_name(const std::string & suffix)
+{
+	return "fingerprints" + suffix + FINGERPRINT_DB_EXT;
+}
+
+#define POSTING_WIDTH_BITS 5	/* a list's delta width, stored as width - 1 */
+#define POSTING_ESCAPE_BITS 32	/* a delta that doesn't fit its width */
+#define POSTING_PADDING 8	/* so get_bits can read a whole word anywhere */
+
+/* Reads width <= 32 bits starting at bit pos of base, low bits first */
+inline uint32_t get_bits(const uint8_t * base, uint64_t pos, unsigned width)
+{
+	uint64_t word;
+	memcpy(&word, base + (pos >> 3), sizeof(word));
+	return (uint32_t) ((word >> (pos & 7)) & ((1ull << width) - 1));
+}
+
+/* Appends width bits of v to the bit stream out holding bits bits */
+inline void put_bits(std::vector<uint8_t> & out, uint64_t & bits, uint32_t v,
+	unsigned width)
+{
+	for (unsigned i = 0; i < width; i++, bits++) {
+		if (!(bits & 7))
+			out.push_back(0);
+		if (v >> i & 1)
+			out.back() |= 1 << (bits & 7);
+	}
+}
+
+/* Walks one compressed posting list */
+class posting_iterator {
+public:
+	posting_iterator(const uint8_t * base, uint64_t pos, uint64_t end)
+		: base(base), pos(pos), next(pos), end(end), width(0), value(0)
+	{
+		if (pos != end) {
+			width = get_bits(base, pos, POSTING_WIDTH_BITS) + 1;
+			this->pos = next = pos + POSTING_WIDTH_BITS;
+			decode();
+		}
+	}
+
+	const song_data & operator*() const { return current; }
+	const song_data * operator->() const { return &current; }
+
+	posting_iterator & operator++()
+	{
+		pos = next;
+		decode();
+		return *this;
+	}
+
+	bool operator==(const posting_iterator & other) const { return pos == other.pos; }
+	bool operator!=(const posting_iterator & other) const { return pos != other.pos; }
+
+private:
+	void decode()
+	{
+		if (pos == end)
+			return;
+		uint32_t delta = get_bits(base, pos, width);
+		next = pos + width;
+		if (delta == (uint32_t) ((1ull << width) - 1)) {
+			delta = get_bits(base, next, POSTING_ESCAPE_BITS);
+			next += POSTING_ESCAPE_BITS;
+		}
+		value += delta;
+		current.time_pt = (uint16_t) value;
+		current.song_ID = (uint16_t) (value >> 16);
+	}
+
+	const uint8_t * base;
+	uint64_t pos;
+	uint64_t next;
+	uint64_t end;
+	unsigned width;
+	uint32_t value;
+	song_data current;
+};
+
+/* Postings of one key, usable in a range-based for */
+struct posting_span {
+	const uint8_t * base;
+	uint64_t first;
+	uint64_t last;
+
+	posting_iterator begin() const { return posting_iterator(base, first, last); }
+	posting_iterator end() const { return posting_iterator(base, last, last); }
+	bool empty() const { return first == last; }
+};
+
+class fingerprint_index {
+public:
+	fingerprint_index() : key_count(0), posting_count(0), posting_bytes_(0), keys_(NULL),
+		offsets_(NULL), postings_(NULL), directory_(NULL),
+		map_base(NULL), map_length(0) {}
+	~fingerprint_index() { unmap(); }
+
+	/* Queues the fingerprints of one song for the next build() */
+	void add(const fingerprint_record * prints, size_t count, uint16_t song_ID)
+	{
+		for (size_t i = 0; i < count; i++) {
+			struct entry e = {prints[i].hash, {prints[i].time, song_ID}};
+			pending.push_back(e);
+		}
+	}
+
+	void add(const std::vector<fingerprint_record> & prints, uint16_t song_ID)
+	{
+		add(prints.empty() ? NULL : &prints[0], prints.size(), song_ID);
+	}
+
+	/*
+	 * Merges everything added so far into the index. Throws
+	 * std::length_error, leaving the index empty, if the postings outgrow
+	 * what 32 bit offsets can address.
+	 */
+	void build()
+	{
+		for (size_t k = 0; k < key_count; k++) {
+			posting_span span = postings_at(k);
+			for (auto it = span.begin(); it != span.end(); ++it) {
+				struct entry e = {keys_[k], *it};
+				pending.push_back(e);
+			}
+		}
+		unmap();
+		std::sort(pending.begin(), pending.end(), entry_less);
+		/* a posting held twice would vote twice for one fingerprint */
+		pending.erase(std::unique(pending.begin(), pending.end(), entry_equal),
+			pending.end());
+
+		keys.clear();
+		offsets.clear();
+		postings.clear();
+		key_count = 0;
+		posting_count = 0;
+		posting_bytes_ = 0;
+		uint64_t bits = 0;
+		for (size_t i = 0, j; i < pending.size(); i = j) {
+			for (j = i; j < pending.size() && pending[j].key == pending[i].key; j++)
+				;
+			keys.push_back(pending[i].key);
+			offsets.push_back(bits);
+			encode(i, j, bits);
+			if (bits > UINT32_MAX) {
+				keys.clear();
+				offsets.clear();
+				postings.clear();
+				std::vector<entry>().swap(pending);
+				throw std::length_error("fingerprint_index: postings over 512MB");
+			}
+		}
+		offsets.push_back(bits);
+		postings.resize(postings.size() + POSTING_PADDING, 0);
+		postings.shrink_to_fit();
+		posting_count = pending.size();
+		std::vector<entry>().swap(pending);
+
+		directory.assign((1u << INDEX_DIRECTORY_BITS) + 1, 0);
+		size_t k = 0;
+		for (uint32_t d = 0; d <= 1u << INDEX_DIRECTORY_BITS; d++) {
+			while (k < keys.size() && directory_slot(keys[k]) < d)
+				k++;
+			directory[d] = k;
+		}
+
+		key_count = keys.size();
+		posting_bytes_ = postings.size();
+		keys_ = keys.empty() ? NULL : &keys[0];
+		offsets_ = &offsets[0];
+		postings_ = postings.empty() ? NULL : &postings[0];
+		directory_ = &directory[0];
+	}
+
+	posting_span lookup(fingerprint_key key) const
+	{
+		posting_span span = {NULL, 0, 0};
+		if (!key_count)
+			return span;
+
+		uint32_t d = directory_slot(key);
+		const fingerprint_key * lo = keys_ + directory_[d];
+		const fingerprint_key * hi = keys_ + directory_[d + 1];
+		const fingerprint_key * it = std::lower_bound(lo, hi, key);
+		if (it != hi && *it == key)
+			span = postings_at(it - keys_);
+		return span;
+	}
+
+	/* Number of postings, i.e. fingerprints indexed */
+	size_t size() const { return posting_count; }
+
+	/* Bytes of compressed postings, with padding */
+	size_t posting_bytes() const { return posting_bytes_; }
+
+	size_t unique_keys() const { return key_count; }
+
+	/* The k-th smallest key and its postings, for walking the index in order */
+	fingerprint_key key_at(size_t k) const { return keys_[k]; }
+
+	posting_span postings_at(size_t k) const
+	{
+		posting_span span = {postings_, offsets_[k], offsets_[k + 1]};
+		return span;
+	}
+
+	/* Bytes held by the index, in memory or mapped */
+	size_t bytes() const
+	{
+		return key_count * sizeof(fingerprint_key)
+			+ (key_count + 1) * sizeof(uint32_t)
+			+ posting_bytes_
+			+ ((1u << INDEX_DIRECTORY_BITS) + 1) * sizeof(uint32_t);
+	}
+
+	/* Writes the built index and the song list to filename */
+	bool save(const std::string & filename,
+		const std::list<database_info> & songs) const
+	{
+		fingerprint_db_header hdr;
+		std::vector<fingerprint_db_song> table;
+		std::string names;
+		FILE * fout;
+		bool ok;
+
+		for (auto it = songs.cbegin(); it != songs.cend(); ++it) {
+			fingerprint_db_song s = {(uint32_t) names.size(),
+				(uint16_t) it->song_name.size(), it->song_ID,
+				(uint32_t) it->hash_count};
+			table.push_back(s);
+			names += it->song_name;
+		}
+
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, FINGERPRINT_DB_MAGIC, 4);
+		hdr.version = FINGERPRINT_DB_VERSION;
+		hdr.freq_bits = HASH_FREQ_BITS;
+		hdr.delta_bits = HASH_DELTA_BITS;
+		hdr.directory_bits = INDEX_DIRECTORY_BITS;
+		hdr.t_zone = T_ZONE;
+		hdr.target_offset = TARGET_OFFSET;
+		hdr.song_count = table.size();
+		hdr.key_count = key_count;
+		hdr.posting_count = posting_count;
+		hdr.directory_offset = sizeof(hdr);
+		hdr.keys_offset = align(hdr.directory_offset
+			+ ((1u << INDEX_DIRECTORY_BITS) + 1) * sizeof(uint32_t));
+		hdr.offsets_offset = align(hdr.keys_offset
+			+ key_count * sizeof(fingerprint_key));
+		hdr.postings_offset = align(hdr.offsets_offset
+			+ (key_count + 1) * sizeof(uint32_t));
+		hdr.songs_offset = align(hdr.postings_offset + posting_bytes_);
+		hdr.names_offset = align(hdr.songs_offset
+			+ table.size() * sizeof(fingerprint_db_song));
+		hdr.names_size = names.size();
+		hdr.postings_size = posting_bytes_;
+
+		fout = fopen(filename.c_str(), "wb");
+		if (!fout) {
+			std::cerr << "could not open " << filename << std::endl;
+			return false;
+		}
+		ok = write_at(fout, 0, &hdr, sizeof(hdr))
+			&& write_at(fout, hdr.directory_offset, directory_,
+				((1u << INDEX_DIRECTORY_BITS) + 1) * sizeof(uint32_t))
+			&& write_at(fout, hdr.keys_offset, keys_,
+				key_count * sizeof(fingerprint_key))
+			&& write_at(fout, hdr.offsets_offset, offsets_,
+				(key_count + 1) * sizeof(uint32_t))
+			&& write_at(fout, hdr.postings_offset, postings_, posting_bytes_)
+			&& write_at(fout, hdr.songs_offset, table.empty() ? NULL : &table[0],
+				table.size() * sizeof(fingerprint_db_song))
+			&& write_at(fout, hdr.names_offset, names.data(), names.size());
+		ok = fclose(fout) == 0 && ok;
+		if (!ok)
+			std::cerr << "could not write " << filename << std::endl;
+		return ok;
+	}
+
+	/*
+	 * Maps a database file written by save() and, if songs isn't NULL,
+	 * appends its song list. Returns false if the file is missing, was
+	 * written with different fingerprint parameters or is malformed.
+	 */
+	bool load(const std::string & filename, std::list<database_info> * songs)
+	{
+		struct stat st;
+		int fd;
+
+		fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd == -1)
+			return false;
+		if (fstat(fd, &st) || st.st_size < (off_t) sizeof(fingerprint_db_header)) {
+			::close(fd);
+			return false;
+		}
+		void * base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (base == MAP_FAILED)
+			return false;
+
+		const fingerprint_db_header * hdr = (const fingerprint_db_header *) base;
+		size_t length = st.st_size;
+		if (memcmp(hdr->magic, FINGERPRINT_DB_MAGIC, 4)
+			|| hdr->version != FINGERPRINT_DB_VERSION
+			|| hdr->freq_bits != HASH_FREQ_BITS
+			|| hdr->delta_bits != HASH_DELTA_BITS
+			|| hdr->directory_bits != INDEX_DIRECTORY_BITS
+			|| hdr->t_zone != T_ZONE
+			|| hdr->target_offset != TARGET_OFFSET
+			|| !fits(hdr->names_offset, hdr->names_size, length)
+			|| !fits(hdr->songs_offset,
+				(uint64_t) hdr->song_count * sizeof(fingerprint_db_song), length)
+			|| !fits(hdr->postings_offset, hdr->postings_size, length)
+			|| !fits(hdr->offsets_offset,
+				((uint64_t) hdr->key_count + 1) * sizeof(uint32_t), length)
+			|| !fits(hdr->keys_offset,
+				(uint64_t) hdr->key_count * sizeof(fingerprint_key), length)
+			|| !fits(hdr->directory_offset,
+				((1u << INDEX_DIRECTORY_BITS) + 1) * sizeof(uint32_t), length)
+			|| !well_formed((const char *) base, hdr)) {
+			std::cerr << filename << ": not a compatible fingerprint database"
+				<< std::endl;
+			munmap(base, length);
+			return false;
+		}
+
+		unmap();
+		keys.clear();
+		offsets.clear();
+		postings.clear();
+		directory.clear();
+		map_base = base;
+		map_length = length;
+		madvise(map_base, map_length, MADV_RANDOM);
+
+		const char * p = (const char *) base;
+		key_count = hdr->key_count;
+		posting_count = hdr->posting_count;
+		posting_bytes_ = hdr->postings_size;
+		directory_ = (const uint32_t *) (p + hdr->directory_offset);
+		keys_ = (const fingerprint_key *) (p + hdr->keys_offset);
+		offsets_ = (const uint32_t *) (p + hdr->offsets_offset);
+		postings_ = (const uint8_t *) (p + hdr->postings_offset);
+
+		if (songs) {
+			const fingerprint_db_song * table =
+				(const fingerprint_db_song *) (p + hdr->songs_offset);
+			const char * names = p + hdr->names_offset;
+			for (uint32_t i = 0; i < hdr->song_count; i++) {
+				struct database_info info;
+				info.song_name.assign(names + table[i].name_offset,
+					table[i].name_length);
+				info.song_ID = table[i].song_ID;
+				info.hash_count = table[i].hash_count;
+				songs->push_back(info);
+			}
+		}
+		return true;
+	}
+
+private:
+	fingerprint_index(const fingerprint_index &);
+	fingerprint_index & operator=(const fingerprint_index &);
+
+	struct entry {
+		fingerprint_key key;
+		song_data value;
+	};
+
+	static uint32_t posting_value(const song_data & d)
+	{
+		return (uint32_t) d.song_ID << 16 | d.time_pt;
+	}
+
+	static bool entry_less(const entry & a, const entry & b)
+	{
+		if (a.key != b.key)
+			return a.key < b.key;
+		return posting_value(a.value) < posting_value(b.value);
+	}
+
+	static bool entry_equal(const entry & a, const entry & b)
+	{
+		return a.key == b.key && posting_value(a.value) == posting_value(b.value);
+	}
+
+	/*
+	 * Appends the posting list of pending[first, last) to postings, with
+	 * the delta width that makes it smallest.
+	 */
+	void encode(size_t first, size_t last, uint64_t & bits)
+	{
+		uint64_t cost[33] = {0};
+		uint32_t prev = 0;
+		for (size_t i = first; i < last; i++) {
+			uint32_t delta = posting_value(pending[i].value) - prev;
+			prev += delta;
+			for (unsigned w = 1; w <= 32; w++)
+				cost[w] += delta < (1ull << w) - 1 ? w : w + POSTING_ESCAPE_BITS;
+		}
+		unsigned width = 1;
+		for (unsigned w = 2; w <= 32; w++)
+			if (cost[w] < cost[width])
+				width = w;
+
+		put_bits(postings, bits, width - 1, POSTING_WIDTH_BITS);
+		prev = 0;
+		for (size_t i = first; i < last; i++) {
+			uint32_t delta = posting_value(pending[i].value) - prev;
+			prev += delta;
+			if (delta < (1ull << width) - 1) {
+				put_bits(postings, bits, delta, width);
+			} else {
+				put_bits(postings, bits, (1ull << width) - 1, width);
+				put_bits(postings, bits, delta, POSTING_ESCAPE_BITS);
+			}
+		}
+	}
+
+	/* Whether size bytes at offset lie within length, without overflowing */
+	static bool fits(uint64_t offset, uint64_t size, uint64_t length)
+	{
+		return size <= length && offset <= length - size;
+	}
+
+	/*
+	 * Whether the arrays of a database the header fits in can be used as
+	 * they are: each key's postings lie within the postings, with the
+	 * padding get_bits reads past them left over, each directory slot is
+	 * a range of keys and each song's name lies within the names.
+	 */
+	static bool well_formed(const char * p, const fingerprint_db_header * hdr)
+	{
+		const uint32_t * offsets = (const uint32_t *) (p + hdr->offsets_offset);
+		const uint32_t * directory = (const uint32_t *) (p + hdr->directory_offset);
+		const fingerprint_db_song * table =
+			(const fingerprint_db_song *) (p + hdr->songs_offset);
+
+		for (uint32_t i = 0; i < hdr->song_count; i++)
+			if (!fits(table[i].name_offset, table[i].name_length, hdr->names_size))
+				return false;
+
+		if (hdr->postings_size < POSTING_PADDING
+			|| offsets[hdr->key_count] > (hdr->postings_size - POSTING_PADDING) * 8)
+			return false;
+		for (uint32_t k = 0; k < hdr->key_count; k++)
+			if (offsets[k] > offsets[k + 1])
+				return false;
+		for (uint32_t d = 0; d <= 1u << INDEX_DIRECTORY_BITS; d++)
+			if (directory[d] > hdr->key_count
+				|| (d && directory[d] < directory[d - 1]))
+				return false;
+		return true;
+	}
+
+	static uint32_t directory_slot(fingerprint_key key)
+	{
+		return key >> (HASH_KEY_BITS - INDEX_DIRECTORY_BITS);
+	}
+
+	static uint64_t align(uint64_t offset)
+	{
+		return (offset + FINGERPRINT_DB_ALIGN - 1) & ~(uint64_t) (FINGERPRINT_DB_ALIGN - 1);
+	}
+
+	static bool write_at(FILE * fout, uint64_t offset, const void * data, size_t size)
+	{
+		return fseek(fout, offset, SEEK_SET) == 0
+			&& (size == 0 || fwrite(data, size, 1, fout) == 1);
+	}
+
+	void unmap()
+	{
+		if (map_base)
+			munmap(map_base, map_length);
+		map_base = NULL;
+		map_length = 0;
+	}
+
+	/* the arrays lookups use, pointing into the vectors or the mapping */
+	size_t key_count;
+	size_t posting_count;
+	size_t posting_bytes_;
+	const fingerprint_key * keys_;
+	const uint32_t * offsets_;
+	const uint8_t * postings_;
+	const uint32_t * directory_;
+
+	std::vector<fingerprint_key> keys;
+	std::vector<uint32_t> offsets;
+	std::vector<uint8_t> postings;
+	std::vector<uint32_t> directory;
+	std::vector<entry> pending;
+
+	void * map_base;
+	size_t map_length;
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Fingerprints of audio that arrives one spectrogram frame at a time.
+ *
+ * Only the last three frames are kept. A frame is peak picked with
+ * frame_peaks as soon as the frame after it arrives, its peaks go through
+ * a peak_pruner, and the pruned peaks through a fingerprint_stream, so the
+ * fingerprints of a recording come out while it is still being made: a
+ * pruning window's worth at a time, PRUNING_TIME_WINDOW frames behind.
+ *
+ * Frame times are 16 bit and wrap like the peak times they become.
+ *
+ * Frames lost on the way, e.g. by a capture that fell behind, are marked
+ * with skip() rather than padded: time moves on over them, so the peaks
+ * after keep their true times, but no peak is picked against a neighbour
+ * across the gap and no fingerprint pairs peaks from either side of it.
+ * A gap too long for 16 bit times to order, LONG_GAP frames or more, ends
+ * the pruning and fingerprinting of the frames before it there and then.
+ */
+
+#ifndef _FRAME_FINGERPRINTER_H
+#define _FRAME_FINGERPRINTER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "shazam.h"
+#include "constellation.h"
+#include "fingerprint.h"
+
+class frame_fingerprinter {
+public:
+	frame_fingerprinter() { reset(); }
+
+	/* Starts a new recording */
+	void reset()
+	{
+		pruner.reset();
+		stream.reset();
+		frames = 0;
+		contiguous = 0;
+		skipped = 0;
+		gap_ends.clear();
+		before_gap.clear();
+	}
+
+	/*
+	 * Adds the next frame, SPECTROGRAM_WIDTH magnitudes, and writes the
+	 * fingerprints it completed to out, replacing its contents. Most
+	 * frames complete none.
+	 */
+	void push(const float * frame, std::vector<fingerprint_record> & out)
+	{
+		memcpy(ring[frames % 3], frame, sizeof(ring[0]));
+		peaks.clear();
+		if (contiguous >= 2) {
+			raw.clear();
+			frame_peaks(ring[(frames - 2) % 3], ring[(frames - 1) % 3],
+				ring[frames % 3], WIDTH - 1 < BIN6 ? WIDTH - 1 : BIN6,
+				frames - 1, raw);
+			for (size_t i = 0; i < raw.size(); i++)
+				pruner.push(raw[i], peaks);
+		}
+		frames++;
+		contiguous++;
+		feed(out);
+	}
+
+	/* Notes that count frames are missing before the next one pushed */
+	void skip(uint32_t count)
+	{
+		if (!count)
+			return;
+		if (count >= LONG_GAP) {
+			peaks.clear();
+			pruner.flush(peaks);
+			feed(flushed);
+			before_gap.insert(before_gap.end(), flushed.begin(), flushed.end());
+			stream.reset();
+			gap_ends.clear();
+			pruner.reset(frames + count);
+		} else {
+			gap_ends.push_back(frames + count);
+		}
+		frames += count;
+		skipped += count;
+		contiguous = 0;
+	}
+
+	/* Ends the recording, writing the fingerprints still held back to out */
+	void flush(std::vector<fingerprint_record> & out)
+	{
+		peaks.clear();
+		pruner.flush(peaks);
+		feed(out);
+		gap_ends.clear();
+	}
+
+	/* Frames since the last reset(), pushed or skipped */
+	uint32_t frame_count() const { return frames; }
+
+	/* Frames skipped since the last reset() */
+	uint32_t skipped_count() const { return skipped; }
+
+	enum { LONG_GAP = 1 << 14 };	/* frames, 87 s */
+
+private:
+	enum { WIDTH = SPECTROGRAM_WIDTH };
+
+	static bool after(uint16_t a, uint16_t b) { return (int16_t) (a - b) > 0; }
+
+	/*
+	 * Writes the fingerprints of peaks to out, starting the stream over at
+	 * each gap they get past, and after any fingerprints from before a
+	 * long gap that no push() has written yet
+	 */
+	void feed(std::vector<fingerprint_record> & out)
+	{
+		size_t from = 0;
+
+		if (gap_ends.empty() && before_gap.empty()) {
+			stream.push(peaks, out);
+			return;
+		}
+		out.swap(before_gap);
+		before_gap.clear();
+		for (size_t i = 0; i < peaks.size() && !gap_ends.empty(); i++) {
+			if (after(gap_ends.front(), peaks[i].time))
+				continue;
+			stream.push(&peaks[0] + from, i - from, gap_prints);
+			out.insert(out.end(), gap_prints.begin(), gap_prints.end());
+			stream.reset();
+			from = i;
+			while (!gap_ends.empty() && !after(gap_ends.front(), peaks[i].time))
+				gap_ends.erase(gap_ends.begin());
+		}
+		stream.push(peaks.empty() ? NULL : &peaks[0] + from, peaks.size() - from,
+			gap_prints);
+		out.insert(out.end(), gap_prints.begin(), gap_prints.end());
+	}
+
+	float ring[3][WIDTH];	/* the last three frames, by frame number % 3 */
+	uint32_t frames;	/* the time of the next frame */
+	uint32_t contiguous;	/* frames pushed since the last gap */
+	uint32_t skipped;
+	peak_pruner pruner;
+	fingerprint_stream stream;
+	std::vector<peak_raw> raw;
+	std::vector<peak> peaks;
+	std::vector<uint16_t> gap_ends;	/* times of the first frames after gaps */
+	std::vector<fingerprint_record> before_gap;	/* not written yet */
+	std::vector<fingerprint_record> gap_prints;
+	std::vector<fingerprint_record> flushed;
+};
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * Vectorized pieces of get_raw_peaks.
+ *
+ * local_max_mask marks the bins of one frame that are greater than their
+ * four neighbours (previous and next frame, bin below and bin above) and
+ * greater than FLT_MIN, writing the amplitude for those bins and 0 for the
+ * rest. band_peak then finds the strongest marked bin of a band, taking
+ * the lowest bin on ties just like the scalar loop did.
+ *
+ * x86 builds carry an SSE2 and an AVX2 version and pick one at run time;
+ * ARM builds use NEON when the compiler targets it.
+ */
+
+#ifndef _LOCAL_MAX_H
+#define _LOCAL_MAX_H
+
+#include <cfloat>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LOCAL_MAX_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LOCAL_MAX_NEON
+#endif
+
+/* out[i] for one bin, also used for bin 0 and the tails */
+inline float local_max_scalar(const float * west, const float * col,
+	const float * east, uint32_t i)
+{
+	float c = col[i];
+	bool peak = c > west[i] && c > east[i] && (i < 1 || c > col[i-1])
+		&& c > col[i+1] && c > FLT_MIN;
+	return peak ? c : 0.0f;
+}
+
+#ifdef LOCAL_MAX_X86
+inline uint32_t local_max_mask_sse2(const float * west, const float * col,
+	const float * east, uint32_t n, float * out)
+{
+	const __m128 floor = _mm_set1_ps(FLT_MIN);
+	uint32_t i = 1;
+
+	for (; i + 4 <= n; i += 4) {
+		__m128 c = _mm_loadu_ps(col + i);
+		__m128 m = _mm_and_ps(_mm_cmpgt_ps(c, _mm_loadu_ps(west + i)),
+			_mm_cmpgt_ps(c, _mm_loadu_ps(east + i)));
+		m = _mm_and_ps(m, _mm_cmpgt_ps(c, _mm_loadu_ps(col + i - 1)));
+		m = _mm_and_ps(m, _mm_cmpgt_ps(c, _mm_loadu_ps(col + i + 1)));
+		m = _mm_and_ps(m, _mm_cmpgt_ps(c, floor));
+		_mm_storeu_ps(out + i, _mm_and_ps(m, c));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+inline uint32_t local_max_mask_avx2(const float * west, const float * col,
+	const float * east, uint32_t n, float * out)
+{
+	const __m256 floor = _mm256_set1_ps(FLT_MIN);
+	uint32_t i = 1;
+
+	for (; i + 8 <= n; i += 8) {
+		__m256 c = _mm256_loadu_ps(col + i);
+		__m256 m = _mm256_and_ps(
+			_mm256_cmp_ps(c, _mm256_loadu_ps(west + i), _CMP_GT_OQ),
+			_mm256_cmp_ps(c, _mm256_loadu_ps(east + i), _CMP_GT_OQ));
+		m = _mm256_and_ps(m, _mm256_cmp_ps(c, _mm256_loadu_ps(col + i - 1), _CMP_GT_OQ));
+		m = _mm256_and_ps(m, _mm256_cmp_ps(c, _mm256_loadu_ps(col + i + 1), _CMP_GT_OQ));
+		m = _mm256_and_ps(m, _mm256_cmp_ps(c, floor, _CMP_GT_OQ));
+		_mm256_storeu_ps(out + i, _mm256_and_ps(m, c));
+	}
+	return i;
+}
+
+inline bool local_max_use_avx2()
+{
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	return avx2;
+}
+#endif
+
+#ifdef LOCAL_MAX_NEON
+inline uint32_t local_max_mask_neon(const float * west, const float * col,
+	const float * east, uint32_t n, float * out)
+{
+	const float32x4_t floor = vdupq_n_f32(FLT_MIN);
+	uint32_t i = 1;
+
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t c = vld1q_f32(col + i);
+		uint32x4_t m = vandq_u32(vcgtq_f32(c, vld1q_f32(west + i)),
+			vcgtq_f32(c, vld1q_f32(east + i)));
+		m = vandq_u32(m, vcgtq_f32(c, vld1q_f32(col + i - 1)));
+		m = vandq_u32(m, vcgtq_f32(c, vld1q_f32(col + i + 1)));
+		m = vandq_u32(m, vcgtq_f32(c, floor));
+		vst1q_f32(out + i, vreinterpretq_f32_u32(
+			vandq_u32(m, vreinterpretq_u32_f32(c))));
+	}
+	return i;
+}
+#endif
+
+/*
+ * out[i] = col[i] if bin i is a local maximum above FLT_MIN, else 0, for
+ * i < n. col[n] must be readable (it is the south neighbour of bin n - 1).
+ */
+inline void local_max_mask(const float * west, const float * col,
+	const float * east, uint32_t n, float * out)
+{
+	uint32_t i = 1;
+
+	if (n == 0)
+		return;
+	out[0] = local_max_scalar(west, col, east, 0);
+#if defined(LOCAL_MAX_X86)
+	if (local_max_use_avx2())
+		i = local_max_mask_avx2(west, col, east, n, out);
+	else
+		i = local_max_mask_sse2(west, col, east, n, out);
+#elif defined(LOCAL_MAX_NEON)
+	i = local_max_mask_neon(west, col, east, n, out);
+#endif
+	for (; i < n; i++)
+		out[i] = local_max_scalar(west, col, east, i);
+}
+
+/*
+ * Strongest marked bin in [lo, hi) of a local_max_mask output, or -1 if
+ * there is none. Ties go to the lowest bin.
+ */
+inline int band_peak(const float * masked, uint32_t lo, uint32_t hi)
+{
+	float best = 0.0f;
+	uint32_t i = lo;
+
+#if defined(LOCAL_MAX_X86)
+	if (i + 4 <= hi) {
+		__m128 m = _mm_loadu_ps(masked + i);
+		for (i += 4; i + 4 <= hi; i += 4)
+			m = _mm_max_ps(m, _mm_loadu_ps(masked + i));
+		m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+		m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+		best = _mm_cvtss_f32(m);
+	}
+#elif defined(LOCAL_MAX_NEON)
+	if (i + 4 <= hi) {
+		float32x4_t m = vld1q_f32(masked + i);
+		for (i += 4; i + 4 <= hi; i += 4)
+			m = vmaxq_f32(m, vld1q_f32(masked + i));
+		float32x2_t h = vpmax_f32(vget_low_f32(m), vget_high_f32(m));
+		best = vget_lane_f32(vpmax_f32(h, h), 0);
+	}
+#endif
+	for (; i < hi; i++)
+		if (masked[i] > best)
+			best = masked[i];
+
+	if (!(best > FLT_MIN))
+		return -1;
+	for (i = lo; masked[i] != best; i++)
+		;
+	return i;
+}
+
+#endif
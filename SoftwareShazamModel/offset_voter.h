@@ -0,0 +1,622 @@
+/*
+ * Offset voting: a sample matches a song when many of its fingerprints
+ * occur in the song at the same time offset, db time - sample time.
+ *
+ * Every index hit of a sample fingerprint votes for the (song, offset) it
+ * implies, on 2^16 possible offsets (times are 16 bit, so offsets wrap the
+ * same way) with saturating 16 bit counters, and a song's score is the
+ * count of its highest bin. With tolerance 1 a bin also counts its two
+ * neighbours, for samples whose frames straddle the song's.
+ *
+ * Most songs a sample votes for only get a few stray hits, so a song's
+ * votes start in a bucket of VOTE_SPARSE_BINS (offset, votes) pairs. Only
+ * a song with votes on more offsets than that is given a flat histogram of
+ * every offset, 136 KiB with a bit per bin to list it for clearing.
+ *
+ * With min_anchor_votes > 1 a sample anchor only votes for a song time it
+ * matched at least that many times, which with T_ZONE is the old
+ * target zone rule: the whole zone of an anchor has to match. The defaults
+ * come from VOTE_ANCHOR_MIN and VOTE_TOLERANCE.
+ *
+ * The buckets, the histograms and the list of bins to clear are kept
+ * between samples, so after the first few voting doesn't allocate. A voter
+ * holds a 128 byte bucket per song voted for and a histogram for each
+ * song past VOTE_SPARSE_BINS offsets in the sample that had the most;
+ * reserve() makes room for every bucket but at most VOTE_RESERVE_SONGS
+ * histograms.
+ *
+ * Votes can also be taken back with remove(), for a window sliding over a
+ * stream. A song whose best offset lost votes is only marked stale, and
+ * its bins are rescanned when its score is next read and could still
+ * matter.
+ *
+ * parallel_voter spreads one sample over several threads, each voting into
+ * its own offset_voter.
+ */
+
+#ifndef _OFFSET_VOTER_H
+#define _OFFSET_VOTER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "shazam.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+
+#define OFFSET_BINS (1u << 16)
+#define OFFSET_VOTE_MAX 0xffff
+
+/* Best offset of a song */
+struct offset_match {
+	uint16_t song_ID;
+	uint16_t offset;	/* db time - sample time, in frames */
+	uint32_t votes;
+};
+
+class offset_voter {
+public:
+	offset_voter(unsigned min_anchor_votes = VOTE_ANCHOR_MIN,
+		unsigned tolerance = VOTE_TOLERANCE)
+		: min_anchor_votes(min_anchor_votes), tolerance(tolerance),
+		histograms(0), zeroed(0) {}
+
+	/*
+	 * Makes room for votes on songs_count songs with IDs up to
+	 * max_song_ID, so voting on them doesn't grow the buckets, and for
+	 * up to VOTE_RESERVE_SONGS histograms.
+	 */
+	void reserve(size_t songs_count, uint16_t max_song_ID)
+	{
+		size_t dense = std::min(songs_count, (size_t) VOTE_RESERVE_SONGS);
+		if (slot_of.size() <= max_song_ID)
+			slot_of.resize(max_song_ID + 1, 0);
+		if (bins.size() < dense * OFFSET_BINS) {
+			bins.resize(dense * OFFSET_BINS, 0);
+			listed.resize(bins.size() / 64, 0);
+			dense_slot.resize(dense);
+		}
+		best.reserve(songs_count);
+		stale.reserve(songs_count);
+		histogram_of.reserve(songs_count);
+		bucket_size.reserve(songs_count);
+		buckets.reserve(songs_count * VOTE_SPARSE_BINS);
+	}
+
+	/* Clears the votes of the previous sample */
+	void reset()
+	{
+		for (size_t i = 0; i < touched.size(); i++) {
+			bins[touched[i]] = 0;
+			listed[touched[i] / 64] = 0;
+		}
+		touched.clear();
+		for (size_t i = 0; i < best.size(); i++)
+			slot_of[best[i].song_ID] = 0;
+		best.clear();
+		stale.clear();
+		histogram_of.clear();
+		bucket_size.clear();
+		histograms = 0;
+		zeroed = 0;
+	}
+
+	/*
+	 * Adds the votes of count sample fingerprints, in anchor order as
+	 * generate_fingerprints writes them.
+	 */
+	void vote(const fingerprint_record * prints, size_t count,
+		const fingerprint_index & database)
+	{
+		if (min_anchor_votes <= 1) {
+			for (size_t i = 0; i < count; i++) {
+				posting_span span = database.lookup(prints[i].hash);
+				for (auto it = span.begin(); it != span.end(); ++it)
+					add(it->song_ID, it->time_pt - prints[i].time, 1);
+			}
+			return;
+		}
+
+		/* the fingerprints of an anchor are consecutive and share its time */
+		for (size_t i = 0, j; i < count; i = j) {
+			anchor_hits.clear();
+			for (j = i; j < count && prints[j].time == prints[i].time; j++) {
+				posting_span span = database.lookup(prints[j].hash);
+				for (auto it = span.begin(); it != span.end(); ++it)
+					anchor_hits.push_back((uint32_t) it->song_ID << 16 | it->time_pt);
+			}
+			std::sort(anchor_hits.begin(), anchor_hits.end());
+			for (size_t h = 0, k; h < anchor_hits.size(); h = k) {
+				for (k = h; k < anchor_hits.size() && anchor_hits[k] == anchor_hits[h]; k++)
+					;
+				if (k - h >= min_anchor_votes)
+					add(anchor_hits[h] >> 16,
+						(uint16_t) anchor_hits[h] - prints[i].time, k - h);
+			}
+		}
+	}
+
+	void vote(const std::vector<fingerprint_record> & prints,
+		const fingerprint_index & database)
+	{
+		vote(prints.empty() ? NULL : &prints[0], prints.size(), database);
+	}
+
+	/* Adds n votes for song_ID at offset */
+	void add(uint16_t song_ID, uint16_t offset, uint32_t n)
+	{
+		if (song_ID >= slot_of.size())
+			slot_of.resize(song_ID + 1, 0);
+		if (!slot_of[song_ID]) {
+			offset_match m = {song_ID, 0, 0};
+			best.push_back(m);
+			stale.push_back(0);
+			histogram_of.push_back(0);
+			bucket_size.push_back(0);
+			if (buckets.size() < best.size() * VOTE_SPARSE_BINS)
+				buckets.resize(best.size() * VOTE_SPARSE_BINS);
+			slot_of[song_ID] = best.size();
+		}
+
+		uint32_t slot = slot_of[song_ID] - 1;
+		uint32_t near[5] = {0};	/* votes at offset - 2 to offset + 2 */
+		if (histogram_of[slot]) {
+			const uint32_t base = (histogram_of[slot] - 1) * OFFSET_BINS;
+			uint32_t bin = base + offset;
+			if (!bins[bin] && !(listed[bin / 64] >> bin % 64 & 1)) {
+				listed[bin / 64] |= (uint64_t) 1 << bin % 64;
+				touched.push_back(bin);
+			}
+			bins[bin] = saturate(bins[bin] + n);
+			for (int d = 0; d < 5; d++)
+				near[d] = bins[base + (uint16_t) (offset + d - 2)];
+		} else {
+			/* one pass over the bucket finds the bin and its neighbours */
+			bucket_bin * b = &buckets[slot * VOTE_SPARSE_BINS];
+			bucket_bin * hit = NULL;
+			for (uint32_t i = 0; i < bucket_size[slot]; i++) {
+				uint16_t d = b[i].offset - offset + 2;
+				if (d < 5) {
+					near[d] = b[i].votes;
+					if (d == 2)
+						hit = &b[i];
+				}
+			}
+			if (!hit) {
+				if (bucket_size[slot] == VOTE_SPARSE_BINS) {
+					spread(slot);
+					add(song_ID, offset, n);
+					return;
+				}
+				hit = &b[bucket_size[slot]++];
+				hit->offset = offset;
+				hit->votes = 0;
+			}
+			hit->votes = saturate(hit->votes + n);
+			near[2] = hit->votes;
+		}
+
+		/* only the scores of the bins counting this one changed */
+		if (tolerance) {
+			improve(best[slot], offset, near[1] + near[2] + near[3]);
+			improve(best[slot], offset - 1, near[0] + near[1] + near[2]);
+			improve(best[slot], offset + 1, near[2] + near[3] + near[4]);
+		} else {
+			improve(best[slot], offset, near[2]);
+		}
+	}
+
+	/*
+	 * Takes back n votes added for song_ID at offset. Bins emptied this
+	 * way stay on the touched list until half of it is empty bins.
+	 */
+	void remove(uint16_t song_ID, uint16_t offset, uint32_t n)
+	{
+		uint32_t slot = slot_of[song_ID] - 1;
+		if (histogram_of[slot]) {
+			uint32_t bin = (histogram_of[slot] - 1) * OFFSET_BINS + offset;
+			if (bins[bin] > n) {
+				bins[bin] -= n;
+			} else {
+				bins[bin] = 0;
+				if (++zeroed > touched.size() / 2)
+					compact();
+			}
+		} else {
+			bucket_bin * b = find(slot, offset);
+			if (b->votes > n)
+				b->votes -= n;
+			else
+				*b = buckets[slot * VOTE_SPARSE_BINS + --bucket_size[slot]];
+		}
+		/* only a best offset counting this bin can have lost votes */
+		if ((uint16_t) (best[slot].offset - offset + tolerance) <= 2 * tolerance)
+			stale[slot] = 1;
+	}
+
+	/* Adds the votes of other, as if its fingerprints had been voted here */
+	void merge(const offset_voter & other)
+	{
+		for (size_t s = 0; s < other.best.size(); s++) {
+			const bucket_bin * b = &other.buckets[s * VOTE_SPARSE_BINS];
+			for (uint32_t i = 0; i < other.bucket_size[s]; i++)
+				add(other.best[s].song_ID, b[i].offset, b[i].votes);
+		}
+		for (size_t i = 0; i < other.touched.size(); i++) {
+			uint32_t bin = other.touched[i];
+			if (other.bins[bin])
+				add(other.best[other.dense_slot[bin / OFFSET_BINS]].song_ID,
+					bin % OFFSET_BINS, other.bins[bin]);
+		}
+	}
+
+	/*
+	 * Writes the best offset of every song that got a vote to out, by
+	 * song_ID. Ties go to the lowest offset.
+	 */
+	void matches(std::vector<offset_match> & out) const
+	{
+		for (size_t s = 0; s < best.size(); s++)
+			if (stale[s])
+				rescan(s);
+		out.assign(best.begin(), best.end());
+		std::sort(out.begin(), out.end(), song_less);
+	}
+
+	/*
+	 * Writes the k songs with the most votes so far to out, best first,
+	 * ties going to the lowest song_ID. Keeps a heap of the k leaders
+	 * instead of sorting every song.
+	 */
+	void leaders(size_t k, std::vector<offset_match> & out) const
+	{
+		out.clear();
+		if (!k)
+			return;
+		for (size_t s = 0; s < best.size(); s++) {
+			/* a stale best is more than the song has, so may rule it out */
+			if (stale[s] && (out.size() < k || ranks_before(best[s], out.front())))
+				rescan(s);
+			if (out.size() < k) {
+				out.push_back(best[s]);
+				std::push_heap(out.begin(), out.end(), ranks_before);
+			} else if (ranks_before(best[s], out.front())) {
+				std::pop_heap(out.begin(), out.end(), ranks_before);
+				out.back() = best[s];
+				std::push_heap(out.begin(), out.end(), ranks_before);
+			}
+		}
+		std::sort_heap(out.begin(), out.end(), ranks_before);
+	}
+
+	/*
+	 * Most votes one more fingerprint can add to a song's score: one hit
+	 * per bin, as the index holds each posting once, on up to 2 *
+	 * tolerance + 1 bins counted together.
+	 */
+	uint32_t max_votes_per_fingerprint() const { return 2 * tolerance + 1; }
+
+	/* Songs with votes on more than VOTE_SPARSE_BINS offsets */
+	size_t histogram_count() const { return histograms; }
+
+private:
+	/* An offset of a song's bucket and its votes */
+	struct bucket_bin {
+		uint16_t offset;
+		uint16_t votes;
+	};
+
+	static uint16_t saturate(uint32_t votes)
+	{
+		return votes < OFFSET_VOTE_MAX ? votes : OFFSET_VOTE_MAX;
+	}
+
+	/* The bin of slot's bucket for offset, or NULL if it has none */
+	bucket_bin * find(uint32_t slot, uint16_t offset) const
+	{
+		bucket_bin * b = &buckets[slot * VOTE_SPARSE_BINS];
+		for (uint32_t i = 0; i < bucket_size[slot]; i++)
+			if (b[i].offset == offset)
+				return &b[i];
+		return NULL;
+	}
+
+	uint32_t votes_at(uint32_t slot, uint16_t offset) const
+	{
+		if (histogram_of[slot])
+			return bins[(size_t) (histogram_of[slot] - 1) * OFFSET_BINS + offset];
+		const bucket_bin * b = find(slot, offset);
+		return b ? b->votes : 0;
+	}
+
+	uint32_t score(uint32_t slot, uint16_t offset) const
+	{
+		uint32_t votes = votes_at(slot, offset);
+		if (tolerance)
+			votes += votes_at(slot, offset - 1) + votes_at(slot, offset + 1);
+		return votes;
+	}
+
+	/* Moves a full bucket into a histogram, reusing one from an earlier sample */
+	void spread(uint32_t slot)
+	{
+		uint32_t h = histograms++;
+		if (bins.size() < histograms * OFFSET_BINS) {
+			bins.resize(histograms * OFFSET_BINS, 0);
+			listed.resize(bins.size() / 64, 0);
+			dense_slot.resize(histograms);
+		}
+		dense_slot[h] = slot;
+		histogram_of[slot] = h + 1;
+
+		const bucket_bin * b = &buckets[slot * VOTE_SPARSE_BINS];
+		for (uint32_t i = 0; i < bucket_size[slot]; i++) {
+			uint32_t bin = h * OFFSET_BINS + b[i].offset;
+			bins[bin] = b[i].votes;
+			listed[bin / 64] |= (uint64_t) 1 << bin % 64;
+			touched.push_back(bin);
+		}
+		bucket_size[slot] = 0;
+	}
+
+	/* Finds the best offset of slot again after votes were removed */
+	void rescan(uint32_t slot) const
+	{
+		offset_match & m = best[slot];
+
+		if (!histogram_of[slot]) {
+			/* only a bin with votes or next to one can score */
+			const bucket_bin * b = &buckets[slot * VOTE_SPARSE_BINS];
+			m.votes = 0;
+			m.offset = 0;
+			for (uint32_t i = 0; i < bucket_size[slot]; i++)
+				for (int d = -(int) tolerance; d <= (int) tolerance; d++) {
+					uint16_t offset = b[i].offset + d;
+					uint32_t votes = score(slot, offset);
+					if (votes > m.votes || (votes == m.votes && offset < m.offset)) {
+						m.votes = votes;
+						m.offset = offset;
+					}
+				}
+			stale[slot] = 0;
+			return;
+		}
+
+		const uint16_t * h = &bins[(size_t) (histogram_of[slot] - 1) * OFFSET_BINS];
+
+		/* the top score first, in a loop the compiler can vectorize */
+		uint32_t top = std::max(score(slot, 0), score(slot, OFFSET_BINS - 1));
+		if (tolerance) {
+			for (uint32_t o = 1; o + 1 < OFFSET_BINS; o++)
+				top = std::max(top, (uint32_t) h[o - 1] + h[o] + h[o + 1]);
+		} else {
+			for (uint32_t o = 1; o + 1 < OFFSET_BINS; o++)
+				top = std::max(top, (uint32_t) h[o]);
+		}
+		m.votes = top;
+		m.offset = 0;
+		while (score(slot, m.offset) != top)
+			m.offset++;
+		stale[slot] = 0;
+	}
+
+	/* Drops the emptied bins from touched */
+	void compact()
+	{
+		size_t n = 0;
+		for (size_t i = 0; i < touched.size(); i++) {
+			uint32_t bin = touched[i];
+			if (bins[bin])
+				touched[n++] = bin;
+			else
+				listed[bin / 64] &= ~((uint64_t) 1 << bin % 64);
+		}
+		touched.resize(n);
+		zeroed = 0;
+	}
+
+	static void improve(offset_match & m, uint16_t offset, uint32_t votes)
+	{
+		if (votes > m.votes || (votes == m.votes && offset < m.offset)) {
+			m.votes = votes;
+			m.offset = offset;
+		}
+	}
+
+	static bool song_less(const offset_match & a, const offset_match & b)
+	{
+		return a.song_ID < b.song_ID;
+	}
+
+	static bool ranks_before(const offset_match & a, const offset_match & b)
+	{
+		if (a.votes != b.votes)
+			return a.votes > b.votes;
+		return a.song_ID < b.song_ID;
+	}
+
+	unsigned min_anchor_votes;
+	unsigned tolerance;
+
+	/* slot s's bucket is buckets[s * VOTE_SPARSE_BINS], bucket_size[s] long */
+	mutable std::vector<bucket_bin> buckets;
+	std::vector<uint8_t> bucket_size;
+	/* histogram h is bins[h * OFFSET_BINS, (h + 1) * OFFSET_BINS) */
+	std::vector<uint16_t> bins;
+	std::vector<uint32_t> histogram_of;	/* by slot, h + 1, or 0 for a bucket */
+	std::vector<uint32_t> dense_slot;	/* by histogram, its slot */
+	uint32_t histograms;		/* in use this sample */
+	std::vector<uint32_t> touched;
+	std::vector<uint64_t> listed;	/* a bit per bin, set while it is in touched */
+	std::vector<uint32_t> slot_of;	/* by song_ID, s + 1, or 0 if no votes yet */
+	/* by slot, each song's best offset so far, or more if stale */
+	mutable std::vector<offset_match> best;
+	mutable std::vector<uint8_t> stale;
+	size_t zeroed;		/* bins emptied by remove() since the last compact() */
+	std::vector<uint32_t> anchor_hits;
+};
+
+/*
+ * Votes a sample with threads offset_voters: the sample is cut into one
+ * slice per thread on anchor boundaries, the calling thread votes the first
+ * and the others are merged into its voter in order. Votes only add up, so
+ * the matches are the same as a single offset_voter's whatever the number
+ * of threads.
+ *
+ * The other threads are started once and wait for work between samples,
+ * and the voters are kept too, so voting allocates no more than a single
+ * offset_voter does.
+ */
+class parallel_voter {
+public:
+	/* threads 0 is one per hardware thread */
+	parallel_voter(unsigned threads = VOTE_THREADS,
+		unsigned min_anchor_votes = VOTE_ANCHOR_MIN,
+		unsigned tolerance = VOTE_TOLERANCE)
+		: job_prints(NULL), job_database(NULL), generation(0), pending(0),
+		stopping(false)
+	{
+		if (!threads)
+			threads = std::thread::hardware_concurrency();
+		if (!threads)
+			threads = 1;
+		voters.assign(threads, offset_voter(min_anchor_votes, tolerance));
+		cut.assign(threads + 1, 0);
+		for (unsigned t = 1; t < threads; t++)
+			workers.push_back(std::thread(&parallel_voter::work, this, t));
+	}
+
+	~parallel_voter()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+	}
+
+	unsigned threads() const { return voters.size(); }
+
+	/* Makes room for votes on songs_count songs with IDs up to max_song_ID */
+	void reserve(size_t songs_count, uint16_t max_song_ID)
+	{
+		for (size_t t = 0; t < voters.size(); t++)
+			voters[t].reserve(songs_count, max_song_ID);
+	}
+
+	void vote(const fingerprint_record * prints, size_t count,
+		const fingerprint_index & database, std::vector<offset_match> & out)
+	{
+		reset();
+		add_votes(prints, count, database);
+		voters[0].matches(out);
+	}
+
+	/* Clears the votes of the previous sample */
+	void reset() { voters[0].reset(); }
+
+	/*
+	 * Adds the votes of count more fingerprints of the sample, which has to
+	 * be cut between anchors, to votes().
+	 */
+	void add_votes(const fingerprint_record * prints, size_t count,
+		const fingerprint_index & database)
+	{
+		size_t n = voters.size();
+		for (size_t t = 1; t <= n; t++) {
+			size_t end = std::max(cut[t - 1], count * t / n);
+			while (end > 0 && end < count && prints[end].time == prints[end - 1].time)
+				end++;
+			cut[t] = end;
+		}
+
+		if (n > 1) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				job_prints = prints;
+				job_database = &database;
+				pending = n - 1;
+				generation++;
+			}
+			wake.notify_all();
+		}
+		voters[0].vote(prints, cut[1], database);
+		if (n > 1) {
+			std::unique_lock<std::mutex> lock(mutex);
+			while (pending)
+				done.wait(lock);
+		}
+
+		for (size_t t = 1; t < n; t++)
+			voters[0].merge(voters[t]);
+	}
+
+	/* The votes so far */
+	const offset_voter & votes() const { return voters[0]; }
+
+	void vote(const std::vector<fingerprint_record> & prints,
+		const fingerprint_index & database, std::vector<offset_match> & out)
+	{
+		vote(prints.empty() ? NULL : &prints[0], prints.size(), database, out);
+	}
+
+private:
+	parallel_voter(const parallel_voter &);
+	parallel_voter & operator=(const parallel_voter &);
+
+	/* thread t > 0 votes its slice afresh, to be merged into the first voter */
+	void vote_slice(size_t t, const fingerprint_record * prints,
+		const fingerprint_index & database)
+	{
+		voters[t].reset();
+		voters[t].vote(prints + cut[t], cut[t + 1] - cut[t], database);
+	}
+
+	/* worker thread t, voting slice t of every sample */
+	void work(size_t t)
+	{
+		unsigned long seen = 0;
+		for (;;) {
+			const fingerprint_record * prints;
+			const fingerprint_index * database;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (!stopping && generation == seen)
+					wake.wait(lock);
+				if (stopping)
+					return;
+				seen = generation;
+				prints = job_prints;
+				database = job_database;
+			}
+			vote_slice(t, prints, *database);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!--pending)
+					done.notify_one();
+			}
+		}
+	}
+
+	std::vector<offset_voter> voters;
+	std::vector<size_t> cut;	/* slice t is [cut[t], cut[t + 1]) */
+	std::vector<std::thread> workers;
+
+	/* the sample being voted, guarded by mutex */
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const fingerprint_record * job_prints;
+	const fingerprint_index * job_database;
+	unsigned long generation;
+	size_t pending;
+	bool stopping;
+};
+
+#endif
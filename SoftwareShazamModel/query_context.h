@@ -0,0 +1,243 @@
+/*
+ * Reusable state for identifying one sample after another.
+ *
+ * A query_context is made once for the songs of a database. It holds a
+ * count_ID per song with its name, the voters, the match list and the
+ * ranking. identify() only clears and refills them, so once the context
+ * has seen its largest sample a query does no heap allocation.
+ *
+ * Each voting thread keeps a 128 byte bucket of votes per song and a
+ * 136 KiB offset histogram only for the songs a sample voted on at more
+ * than VOTE_SPARSE_BINS offsets (see offset_voter.h). Every bucket but
+ * only VOTE_RESERVE_SONGS histograms are made up front, so a context
+ * starts at up to threads * 8.5 MiB whatever the number of songs.
+ *
+ * identify_top() only finds the leaders, and stops voting once the
+ * runner-up can't catch up: the sample is voted TOPK_CHUNK fingerprints at
+ * a time, and after each chunk the leader's lead is compared with the most
+ * votes the remaining fingerprints could still give a song. The leader is
+ * then always the one voting everything would find, though few samples
+ * stop much before the end. With TOPK_ESTIMATE the bound is instead
+ * guessed from the leader's votes per fingerprint so far, as a wrong song
+ * usually gains far slower than the right one; that stops about halfway
+ * through a sample, but is a heuristic and can stop on the wrong song.
+ *
+ * A sample still being recorded can be voted as it comes with begin() and
+ * add(), which return the leaders so far; a leader with ANSWER_CONFIDENCE
+ * is a likely early answer, though the rest of the sample could still
+ * overturn it.
+ */
+
+#ifndef _QUERY_CONTEXT_H
+#define _QUERY_CONTEXT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include "shazam.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+#include "offset_voter.h"
+
+#ifndef TOPK_CHUNK
+#define TOPK_CHUNK 256		/* fingerprints voted between checks */
+#endif
+#ifndef TOPK_MARGIN
+#define TOPK_MARGIN 8		/* votes the leader needs over the runner-up */
+#endif
+#ifndef TOPK_ESTIMATE
+#define TOPK_ESTIMATE 0		/* 1: stop on an estimated, not a certain, lead */
+#endif
+#ifndef ANSWER_CONFIDENCE
+#define ANSWER_CONFIDENCE .75f	/* confidence() of an early answer */
+#endif
+
+/* Leaders of a sample, from query_context::identify_top() */
+struct top_result {
+	std::vector<offset_match> leaders;	/* best first */
+	uint32_t lead;		/* leader votes - runner-up votes */
+	float confidence;	/* lead / leader votes */
+	size_t consumed;	/* fingerprints voted before stopping */
+
+	/* The leader is far enough ahead to answer with */
+	bool answered(float min_confidence = ANSWER_CONFIDENCE,
+		uint32_t margin = TOPK_MARGIN) const
+	{
+		return lead >= margin && confidence >= min_confidence;
+	}
+};
+
+class query_context {
+public:
+	query_context(const std::list<database_info> & song_list,
+		unsigned threads = VOTE_THREADS)
+		: voter(threads)
+	{
+		uint16_t max_song_ID = 0;
+		for (auto it = song_list.cbegin(); it != song_list.cend(); ++it) {
+			count_ID c;
+			c.song = it->song_name;
+			c.count = 0;
+			c.offset = 0;
+			c.num_hashes = it->hash_count;
+			songs.push_back(c);
+			max_song_ID = std::max(max_song_ID, it->song_ID);
+		}
+		slot_of.assign(max_song_ID + 1, 0);
+		size_t s = 0;
+		for (auto it = song_list.cbegin(); it != song_list.cend(); ++it)
+			slot_of[it->song_ID] = ++s;
+
+		voter.reserve(songs.size(), max_song_ID);
+		matches.reserve(songs.size());
+		ranking.resize(songs.size());
+		top.leaders.reserve(std::max(songs.size(), (size_t) 2));
+		begin();
+	}
+
+	/* Starts a sample whose fingerprints are given to add() as they come */
+	void begin()
+	{
+		voter.reset();
+		top.leaders.clear();
+		top.lead = 0;
+		top.confidence = 0;
+		top.consumed = 0;
+	}
+
+	/*
+	 * Votes count more fingerprints of the sample begun, in whole anchors,
+	 * and returns its k leaders so far. The result stays valid until the
+	 * next call.
+	 */
+	const top_result & add(const fingerprint_record * prints, size_t count,
+		const fingerprint_index & database, size_t k = 1)
+	{
+		voter.add_votes(prints, count, database);
+		top.consumed += count;
+
+		voter.votes().leaders(std::max(k, (size_t) 2), top.leaders);
+		uint32_t first = top.leaders.size() > 0 ? top.leaders[0].votes : 0;
+		uint32_t second = top.leaders.size() > 1 ? top.leaders[1].votes : 0;
+		top.lead = first - second;
+		top.confidence = first ? (float) top.lead / first : 0;
+		if (top.leaders.size() > k)
+			top.leaders.resize(k);
+		return top;
+	}
+
+	const top_result & add(const std::vector<fingerprint_record> & prints,
+		const fingerprint_index & database, size_t k = 1)
+	{
+		return add(prints.empty() ? NULL : &prints[0], prints.size(), database, k);
+	}
+
+	/*
+	 * Finds the k songs with the most votes, stopping early once the
+	 * leader is margin votes ahead of the runner-up and the fingerprints
+	 * not yet voted couldn't close the gap, or with TOPK_ESTIMATE aren't
+	 * expected to. The result stays valid until the next call.
+	 */
+	const top_result & identify_top(const fingerprint_record * prints,
+		size_t count, const fingerprint_index & database,
+		size_t k = 1, uint32_t margin = TOPK_MARGIN)
+	{
+		begin();
+		do {
+			size_t end = std::min(count, top.consumed + TOPK_CHUNK);
+			while (end < count && prints[end].time == prints[end - 1].time)
+				end++;
+			add(prints + top.consumed, end - top.consumed, database, k);
+		} while (top.consumed < count && (top.lead < margin
+			|| top.lead <= (count - top.consumed) * votes_per_fingerprint()));
+		return top;
+	}
+
+	const top_result & identify_top(const std::vector<fingerprint_record> & prints,
+		const fingerprint_index & database, size_t k = 1,
+		uint32_t margin = TOPK_MARGIN)
+	{
+		return identify_top(prints.empty() ? NULL : &prints[0], prints.size(),
+			database, k, margin);
+	}
+
+	/*
+	 * Identifies a sample, returning every song of the database ranked
+	 * best first: most votes, then highest score(), each with where in it
+	 * the sample starts. The ranking stays valid until the next call.
+	 */
+	const std::vector<const count_ID *> & identify(
+		const fingerprint_record * prints, size_t count,
+		const fingerprint_index & database)
+	{
+		for (size_t s = 0; s < songs.size(); s++) {
+			songs[s].count = 0;
+			songs[s].offset = 0;
+		}
+
+		voter.vote(prints, count, database, matches);
+		//count is the number of fingerprints agreeing on the song's best offset
+		for (size_t m = 0; m < matches.size(); m++) {
+			uint16_t song_ID = matches[m].song_ID;
+			if (song_ID < slot_of.size() && slot_of[song_ID]) {
+				songs[slot_of[song_ID] - 1].count = matches[m].votes;
+				songs[slot_of[song_ID] - 1].offset = matches[m].offset;
+			}
+		}
+
+		for (size_t s = 0; s < songs.size(); s++)
+			ranking[s] = &songs[s];
+		std::sort(ranking.begin(), ranking.end(), rank_before);
+		return ranking;
+	}
+
+	const std::vector<const count_ID *> & identify(
+		const std::vector<fingerprint_record> & prints,
+		const fingerprint_index & database)
+	{
+		return identify(prints.empty() ? NULL : &prints[0], prints.size(), database);
+	}
+
+	/* The song of song_ID, which must be in the song list */
+	const count_ID & song(uint16_t song_ID) const
+	{
+		return songs[slot_of[song_ID] - 1];
+	}
+
+	/* Votes per database fingerprint of the song, scaled by NORM_POW */
+	static float score(const count_ID & c)
+	{
+		return ((float) c.count)/std::pow(c.num_hashes, NORM_POW);
+	}
+
+private:
+	/*
+	 * Most votes a song can gain from each remaining fingerprint or, with
+	 * TOPK_ESTIMATE, is expected to
+	 */
+	double votes_per_fingerprint() const
+	{
+		if (!TOPK_ESTIMATE || top.leaders.empty())
+			return voter.votes().max_votes_per_fingerprint();
+		return (double) top.leaders[0].votes / top.consumed;
+	}
+
+	static bool rank_before(const count_ID * lhs, const count_ID * rhs)
+	{
+		if (lhs->count != rhs->count)
+			return lhs->count > rhs->count;
+		return score(*lhs) > score(*rhs);
+	}
+
+	parallel_voter voter;
+	std::vector<offset_match> matches;
+	std::vector<count_ID> songs;		/* in song_list order */
+	std::vector<uint32_t> slot_of;		/* by song_ID, index in songs + 1 */
+	std::vector<const count_ID *> ranking;
+	top_result top;
+};
+
+#endif
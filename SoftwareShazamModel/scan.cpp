@@ -0,0 +1,229 @@
+/*
+ * Lists every catalog song heard in a long recording, e.g. hours of a
+ * broadcast, with where in the recording it starts and ends and where in
+ * the song that is (see scanner.h).
+ *
+ * Usage:
+ *   scan [-t threads] [-d file.db] <recording.wav | recording.magspec>
+ *
+ * The database defaults to fingerprints_48.magpeak.db, written by build_db.
+ * A WAV file is transformed as it is read, so only a window of it is ever
+ * in memory; a .magspec is mapped. Each of the threads (by default one per
+ * hardware thread) scans a part of the recording.
+ */
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include "shazam.h"
+#include "spectrogram.h"
+#include "constellation.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+#include "frame_fingerprinter.h"
+#include "scanner.h"
+#include "stft.h"
+
+/* Spectrogram frames of a recording, read in order from any frame on */
+class frame_reader {
+public:
+	frame_reader() : engine(NFFT), samples(NFFT), mag(NFFT/2), filled(0), count(0),
+		next(0) {}
+
+	bool open(const std::string & filename)
+	{
+		if (filename.size() > 8
+			&& filename.compare(filename.size() - 8, 8, ".magspec") == 0) {
+			if (!spec.open(filename))
+				return false;
+			if (spec.bins() < SPECTROGRAM_WIDTH) {
+				std::cerr << filename << ": " << spec.bins()
+					<< " bins per frame, need " << SPECTROGRAM_WIDTH << std::endl;
+				return false;
+			}
+			count = spec.frames();
+			return true;
+		}
+		if (!wav.open(filename))
+			return false;
+		if (wav.rate() != SAMPLING_FREQ)
+			std::cerr << filename << ": " << wav.rate() << " Hz, the catalog is "
+				<< SAMPLING_FREQ << " Hz" << std::endl;
+		count = stft_frames(wav.length(), NFFT);
+		return true;
+	}
+
+	uint64_t frames() const { return count; }
+
+	/* Makes frame t the next one read */
+	bool seek(uint64_t t)
+	{
+		next = t;
+		if (spec.is_open())
+			return true;
+		filled = 0;
+		return wav.seek(t * FRAME_HOP);
+	}
+
+	/* Reads the next frame's SPECTROGRAM_WIDTH magnitudes into frame */
+	bool read(float * frame)
+	{
+		if (next >= count)
+			return false;
+		if (spec.is_open()) {
+			spec.read_frame(next++, frame, SPECTROGRAM_WIDTH);
+			return true;
+		}
+		/* keep the window's last NFFT - FRAME_HOP samples, read the rest */
+		if (filled == NFFT)
+			memmove(&samples[0], &samples[FRAME_HOP],
+				(NFFT - FRAME_HOP) * sizeof(float));
+		size_t keep = filled ? NFFT - FRAME_HOP : 0;
+		if (wav.read(&samples[keep], NFFT - keep) != NFFT - keep)
+			return false;
+		filled = NFFT;
+		engine.transform(&samples[0], &mag[0], NULL);
+		memcpy(frame, &mag[0], SPECTROGRAM_WIDTH * sizeof(float));
+		next++;
+		return true;
+	}
+
+private:
+	spectrogram_file spec;
+	wav_reader wav;
+	stft_engine engine;
+	std::vector<float> samples;	/* the frame's NFFT samples */
+	std::vector<float> mag;
+	size_t filled;
+	uint64_t count;
+	uint64_t next;
+};
+
+/* Scans one part of filename into found; false if it can't be read */
+bool scan_part_of(const std::string & filename, const scan_part & part,
+	const fingerprint_index & db, size_t songs_count, uint16_t max_song_ID,
+	std::vector<occurrence> & found)
+{
+	frame_reader reader;
+	frame_fingerprinter fingerprinter;
+	stream_scanner scanner;
+	std::vector<fingerprint_record> prints;
+	float frame[SPECTROGRAM_WIDTH];
+
+	if (!reader.open(filename) || !reader.seek(part.origin))
+		return false;
+	scanner.reserve(songs_count, max_song_ID);
+	scanner.begin(part.origin, part.first, part.last);
+
+	/* past the part, until its last anchors have all their fingerprints */
+	uint64_t end = std::min(reader.frames(), part.last + SCAN_TAIL);
+	for (uint64_t t = part.origin; t < end; t++) {
+		if (!reader.read(frame))
+			return false;
+		fingerprinter.push(frame, prints);
+		if (!prints.empty())
+			scanner.push(prints, db, t);
+	}
+	fingerprinter.flush(prints);
+	scanner.push(prints, db, end - 1);
+	scanner.finish();
+	found = scanner.occurrences();
+	return true;
+}
+
+/* h:mm:ss.s of a recording frame */
+std::string timestamp(uint64_t frame)
+{
+	uint64_t tenths = (frame * FRAME_HOP * 10 + SAMPLING_FREQ / 2) / SAMPLING_FREQ;
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%u:%02u:%02u.%u", (unsigned) (tenths / 36000),
+		(unsigned) (tenths / 600 % 60), (unsigned) (tenths / 10 % 60),
+		(unsigned) (tenths % 10));
+	return buf;
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	std::string db_file = fingerprint_db_name("_48.magpeak");
+	std::string filename;
+	std::list<database_info> songs;
+	std::vector<std::string> names;		/* by song_ID */
+	fingerprint_index db;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-t" && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (arg == "-d" && i + 1 < argc) {
+			db_file = argv[++i];
+		} else if (filename.empty() && arg[0] != '-') {
+			filename = arg;
+		} else {
+			filename.clear();
+			break;
+		}
+	}
+	if (filename.empty()) {
+		std::cerr << "usage: scan [-t threads] [-d file.db] "
+			"<recording.wav | recording.magspec>" << std::endl;
+		return 1;
+	}
+	threads = std::max(threads, 1u);
+
+	if (!db.load(db_file, &songs)) {
+		std::cerr << "could not load " << db_file << ", run build_db" << std::endl;
+		return 1;
+	}
+	for (auto it = songs.cbegin(); it != songs.cend(); ++it) {
+		if (names.size() <= it->song_ID)
+			names.resize(it->song_ID + 1);
+		names[it->song_ID] = it->song_name;
+	}
+
+	frame_reader reader;
+	if (!reader.open(filename))
+		return 1;
+	std::vector<scan_part> parts;
+	plan_scan(reader.frames(), threads, parts);
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::vector<occurrence> > found(parts.size());
+	std::vector<char> ok(parts.size());
+	std::vector<std::thread> workers;
+	for (size_t p = 0; p < parts.size(); p++)
+		workers.push_back(std::thread([&, p] {
+			ok[p] = scan_part_of(filename, parts[p], db, songs.size(),
+				names.size() - 1, found[p]);
+		}));
+	for (size_t p = 0; p < workers.size(); p++)
+		workers[p].join();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::vector<occurrence> all;
+	for (size_t p = 0; p < parts.size(); p++) {
+		if (!ok[p])
+			return 1;
+		all.insert(all.end(), found[p].begin(), found[p].end());
+	}
+	merge_occurrences(all);
+
+	for (size_t i = 0; i < all.size(); i++) {
+		const occurrence & o = all[i];
+		std::cout << timestamp(o.start) << " - " << timestamp(o.end) << "  "
+			<< names[o.song_ID] << " @" << frames_to_seconds(o.song_start)
+			<< "s /" << o.votes << " votes" << std::endl;
+	}
+	double seconds = reader.frames() * (double) FRAME_HOP / SAMPLING_FREQ;
+	std::cout << all.size() << " occurrences in " << timestamp(reader.frames())
+		<< " of audio, scanned in " << elapsed.count() << " s on "
+		<< parts.size() << " threads, " << seconds / elapsed.count()
+		<< "x realtime" << std::endl;
+	return 0;
+}
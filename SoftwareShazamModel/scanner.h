@@ -0,0 +1,284 @@
+/*
+ * Long-form scanning: finds every catalog song heard in a recording of any
+ * length, as (song, start, end) occurrences.
+ *
+ * A stream_scanner takes the fingerprints of the recording as they are
+ * made and votes them into a sliding_voter over the last SCAN_WINDOW
+ * frames. Every SCAN_HOP frames, so windows overlap, the leader of the
+ * window is checked: with SCAN_MIN_VOTES votes and ANSWER_CONFIDENCE of
+ * them over the runner-up, its song is being heard. Checks hearing the same
+ * song at the same alignment (song frame - recording frame) make one
+ * occurrence, whose ends are the first and last anchors of the window that
+ * voted for it. Memory is that of one window, whatever the recording's
+ * length.
+ *
+ * Recording frames are counted in 64 bits. Fingerprint times are the low
+ * 16 bits of the frame counted from where the scan began, and are only
+ * compared within a window.
+ *
+ * plan_scan() cuts a recording into a part per thread. A part is scanned
+ * from SCAN_WARMUP frames before it, so its window is full when it begins,
+ * and merge_occurrences() joins the occurrences of neighbouring parts.
+ */
+
+#ifndef _SCANNER_H
+#define _SCANNER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "shazam.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+#include "sliding_voter.h"
+#include "query_context.h"
+
+#ifndef SCAN_WINDOW
+#define SCAN_WINDOW 2000	/* frames voted together, 10.7 s */
+#endif
+#ifndef SCAN_HOP
+#define SCAN_HOP 500		/* frames between checks */
+#endif
+#ifndef SCAN_MIN_VOTES
+#define SCAN_MIN_VOTES 20	/* leader votes that can be an occurrence */
+#endif
+#ifndef SCAN_ALIGN
+#define SCAN_ALIGN 2		/* frames an occurrence's alignment may drift */
+#endif
+/* an occurrence ends where SCAN_EDGE_ANCHORS of its anchors are this close */
+#define SCAN_EDGE_ANCHORS 3
+#define SCAN_EDGE_GAP 200
+
+/* Frames before a part to fill the window and the pruner, and after it */
+#define SCAN_WARMUP (SCAN_WINDOW + 2 * PRUNING_TIME_WINDOW)
+#define SCAN_TAIL (2 * PRUNING_TIME_WINDOW)
+
+static_assert(SCAN_WINDOW < 1 << 15, "fingerprint times wrap at 2^16");
+static_assert(SCAN_WARMUP % SCAN_HOP == 0 && SCAN_WARMUP % PRUNING_TIME_WINDOW == 0,
+	"parts must check and prune on the same frames as a whole scan");
+
+struct occurrence {
+	uint16_t song_ID;
+	uint16_t song_start;	/* frame of the song heard at start */
+	uint32_t votes;		/* most votes a window gave it */
+	uint64_t start;		/* first anchor frame of the recording it is heard at */
+	uint64_t end;		/* last */
+};
+
+class stream_scanner {
+public:
+	stream_scanner() : live(SCAN_WINDOW) { begin(0); }
+
+	void reserve(size_t songs_count, uint16_t max_song_ID)
+	{
+		live.reserve(songs_count, max_song_ID);
+	}
+
+	/*
+	 * Starts a scan at frame origin of a recording, origin being a
+	 * multiple of SCAN_HOP. For a part of the recording, anchors from
+	 * frame last on are left out and occurrences ending before frame
+	 * first are dropped.
+	 */
+	void begin(uint64_t origin, uint64_t first = 0, uint64_t last = UINT64_MAX)
+	{
+		live.reset();
+		found.clear();
+		heard = false;
+		this->origin = origin;
+		this->first = first;
+		this->last = last;
+		newest = origin;
+		next_check = origin + SCAN_HOP;
+	}
+
+	/*
+	 * Votes the fingerprints made since the last push, in anchor order.
+	 * now is the newest frame given to the fingerprinter; the anchors are
+	 * a few pruning windows behind it at most.
+	 */
+	void push(const fingerprint_record * prints, size_t count,
+		const fingerprint_index & database, uint64_t now)
+	{
+		uint16_t now_time = (uint16_t) (now - origin);
+
+		for (size_t i = 0, j; i < count; i = j) {
+			uint16_t time = prints[i].time;
+			for (j = i; j < count && prints[j].time == time; j++)
+				;
+			uint64_t frame = now - (uint16_t) (now_time - time);
+			if (frame >= last)
+				continue;
+			/* a silence skips checks, as its windows would be the same */
+			if (frame >= next_check) {
+				check();
+				next_check = (frame / SCAN_HOP + 1) * SCAN_HOP;
+			}
+			live.push(prints + i, j - i, database);
+			newest = frame;
+		}
+	}
+
+	void push(const std::vector<fingerprint_record> & prints,
+		const fingerprint_index & database, uint64_t now)
+	{
+		push(prints.empty() ? NULL : &prints[0], prints.size(), database, now);
+	}
+
+	/* Ends the scan, closing the occurrence still being heard */
+	void finish()
+	{
+		check();
+		if (heard)
+			close();
+	}
+
+	/* Occurrences found so far, in order */
+	const std::vector<occurrence> & occurrences() const { return found; }
+
+private:
+	/* Checks the window ending at the last anchor pushed */
+	void check()
+	{
+		live.leaders(2, leaders);
+		uint32_t votes = leaders.size() > 0 ? leaders[0].votes : 0;
+		uint32_t second = leaders.size() > 1 ? leaders[1].votes : 0;
+		bool hearing = votes >= SCAN_MIN_VOTES
+			&& votes - second >= ANSWER_CONFIDENCE * votes;
+
+		if (heard && (!hearing || leaders[0].song_ID != current.song_ID
+			|| std::abs((int16_t) (leaders[0].offset - offset)) > SCAN_ALIGN))
+			close();
+		if (hearing && !heard)
+			open(leaders[0]);
+		if (heard) {
+			current.votes = std::max(current.votes, votes);
+			extend();
+		}
+	}
+
+	void open(const offset_match & m)
+	{
+		live.anchor_times(m.song_ID, m.offset, times);
+		uint16_t start = first_edge();
+		current.song_ID = m.song_ID;
+		current.song_start = start + m.offset;
+		current.votes = 0;
+		current.start = frame_of(start);
+		current.end = current.start;
+		offset = m.offset;
+		heard = true;
+	}
+
+	/*
+	 * Moves the end of current to its last anchors in the window. A song
+	 * can still lead a window it has left all but the oldest hop of, so
+	 * this is done at every check, not once it has gone.
+	 */
+	void extend()
+	{
+		live.anchor_times(current.song_ID, offset, times);
+		if (!times.empty())
+			current.end = std::max(current.end, frame_of(last_edge()));
+	}
+
+	void close()
+	{
+		extend();
+		if (current.end >= first)
+			found.push_back(current);
+		heard = false;
+	}
+
+	/* Recording frame of a fingerprint time in the window */
+	uint64_t frame_of(uint16_t time) const
+	{
+		return newest - (uint16_t) ((uint16_t) (newest - origin) - time);
+	}
+
+	/* The first of SCAN_EDGE_ANCHORS times close together, past stray matches */
+	uint16_t first_edge() const
+	{
+		for (size_t i = 0; i + SCAN_EDGE_ANCHORS <= times.size(); i++)
+			if ((uint16_t) (times[i + SCAN_EDGE_ANCHORS - 1] - times[i]) <= SCAN_EDGE_GAP)
+				return times[i];
+		return times.empty() ? (uint16_t) (newest - origin) : times.front();
+	}
+
+	/* Likewise the last, times not being empty */
+	uint16_t last_edge() const
+	{
+		for (size_t i = times.size(); i >= SCAN_EDGE_ANCHORS; i--)
+			if ((uint16_t) (times[i - 1] - times[i - SCAN_EDGE_ANCHORS]) <= SCAN_EDGE_GAP)
+				return times[i - 1];
+		return times.back();
+	}
+
+	sliding_voter live;
+	std::vector<offset_match> leaders;
+	std::vector<uint16_t> times;
+	std::vector<occurrence> found;
+	occurrence current;
+	uint16_t offset;	/* of current, in the window's times */
+	bool heard;		/* current is being heard */
+	uint64_t origin;
+	uint64_t first;
+	uint64_t last;
+	uint64_t newest;	/* frame of the last anchor pushed */
+	uint64_t next_check;
+};
+
+/* Frames [first, last) of a recording, scanned from origin on */
+struct scan_part {
+	uint64_t origin;
+	uint64_t first;
+	uint64_t last;
+};
+
+/* Cuts frames frames into up to parts parts of whole SCAN_HOPs */
+inline void plan_scan(uint64_t frames, unsigned parts, std::vector<scan_part> & out)
+{
+	uint64_t step = (frames / std::max(parts, 1u) / SCAN_HOP + 1) * SCAN_HOP;
+
+	out.clear();
+	for (uint64_t first = 0; first < frames; first += step) {
+		scan_part p = {first > SCAN_WARMUP ? first - SCAN_WARMUP : 0, first,
+			std::min(frames, first + step)};
+		out.push_back(p);
+	}
+}
+
+inline bool occurrence_before(const occurrence & a, const occurrence & b)
+{
+	return a.start < b.start;
+}
+
+/*
+ * Sorts occurrences by start and joins those of one song at one alignment
+ * that overlap or are at most a window apart: the halves of an occurrence
+ * two parts both saw, or one that dropped out for a check.
+ */
+inline void merge_occurrences(std::vector<occurrence> & all)
+{
+	std::sort(all.begin(), all.end(), occurrence_before);
+	size_t n = 0;
+	for (size_t i = 0; i < all.size(); i++) {
+		if (n) {
+			occurrence & prev = all[n - 1];
+			uint16_t align = prev.song_start - (uint16_t) prev.start;
+			uint16_t next_align = all[i].song_start - (uint16_t) all[i].start;
+			if (all[i].song_ID == prev.song_ID
+				&& std::abs((int16_t) (next_align - align)) <= SCAN_ALIGN
+				&& all[i].start <= prev.end + SCAN_WINDOW) {
+				prev.end = std::max(prev.end, all[i].end);
+				prev.votes = std::max(prev.votes, all[i].votes);
+				continue;
+			}
+		}
+		all[n++] = all[i];
+	}
+	all.resize(n);
+}
+
+#endif
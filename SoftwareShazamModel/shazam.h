@@ -0,0 +1,133 @@
+/*
+ * Parameters and types shared by the recognition programs.
+ *
+ * A program may #define any of the parameters below before including this
+ * header to override the default (the board uses a narrower BIN6, for
+ * example).
+ */
+
+#ifndef _SHAZAM_H
+#define _SHAZAM_H
+
+#include <string>
+#include <cstdint>
+
+#ifndef NFFT
+#define NFFT 512
+#define NBINS 6
+#define BIN0 0
+#define BIN1 10
+#define BIN2 20
+#define BIN3 40
+#define BIN4 80
+#define BIN5 160
+#define BIN6 240
+#endif
+
+#ifndef PRUNING_COEF
+#define PRUNING_COEF 1.4f
+#endif
+#ifndef PRUNING_TIME_WINDOW
+#define PRUNING_TIME_WINDOW 500
+#endif
+#ifndef NORM_POW
+#define NORM_POW 1.0f
+#endif
+#ifndef STD_DEV_COEF
+#define STD_DEV_COEF 1.25
+#endif
+#ifndef T_ZONE
+#define T_ZONE 4
+#endif
+#ifndef TARGET_OFFSET
+#define TARGET_OFFSET 2
+#endif
+#ifndef VOTE_ANCHOR_MIN
+#define VOTE_ANCHOR_MIN 1
+#endif
+#ifndef VOTE_TOLERANCE
+#define VOTE_TOLERANCE 1
+#endif
+#ifndef VOTE_THREADS
+#define VOTE_THREADS 0	/* one per hardware thread */
+#endif
+#ifndef VOTE_SPARSE_BINS
+#define VOTE_SPARSE_BINS 32	/* offsets a song is voted on before it gets a histogram */
+#endif
+#ifndef VOTE_RESERVE_SONGS
+#define VOTE_RESERVE_SONGS 64	/* histograms a voter makes room for up front */
+#endif
+#ifndef SAMPLING_FREQ
+#define SAMPLING_FREQ 48000	/* Hz, of the audio the spectrograms are of */
+#endif
+#ifndef FRAME_HOP
+#define FRAME_HOP (NFFT/2)	/* audio samples from one frame to the next */
+#endif
+#ifndef MAX_BINS_FLOOR
+#define MAX_BINS_FLOOR .125
+#endif
+#ifndef MAX_BINS_TIME_BIN
+#define MAX_BINS_TIME_BIN 50
+#endif
+#ifndef MAX_BINS_COEF
+#define MAX_BINS_COEF 1.85
+#endif
+
+/*
+ * Bins kept per spectrogram frame. Nothing at or above BIN6 is ever a peak,
+ * but bin BIN6 is still the south neighbour of bin BIN6 - 1.
+ */
+#define SPECTROGRAM_WIDTH (BIN6 + 1 < NFFT/2 ? BIN6 + 1 : NFFT/2)
+
+struct peak_raw {
+	float ampl;
+	uint16_t freq;
+	uint16_t time;
+};
+
+struct peak {
+	uint16_t freq;
+	uint16_t time;
+};
+
+struct song_data {
+	uint16_t time_pt;
+	uint16_t song_ID;
+};
+
+struct count_ID {
+	std::string song;
+	int count;
+	int num_hashes;
+	uint16_t offset;	/* frames into the song the sample starts, at count */
+};
+
+struct database_info{
+	std::string song_name;
+	uint16_t song_ID;
+	int hash_count;
+};
+
+/* Seconds of audio spanned by frames spectrogram frames */
+inline float frames_to_seconds(uint32_t frames)
+{
+	return (float) frames * FRAME_HOP / SAMPLING_FREQ;
+}
+
+inline int freq_to_bin(uint16_t freq) {
+	if (freq <  BIN1)
+		return 1;
+	if (freq <  BIN2)
+		return 2;
+	if (freq <  BIN3)
+		return 3;
+	if (freq <  BIN4)
+		return 4;
+	if (freq <  BIN5)
+		return 5;
+	if (freq <  BIN6)
+		return 6;
+	return 0;
+}
+
+#endif
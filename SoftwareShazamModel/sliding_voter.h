@@ -0,0 +1,224 @@
+/*
+ * Continuous identification: votes over the last `window` frames of a live
+ * stream.
+ *
+ * Fingerprints are pushed as the stream produces them, in anchor order.
+ * Each index hit is voted into one offset_voter and also kept, with its
+ * anchor time, in a queue; once the newest anchor is window frames past a
+ * hit's, the hit is taken back out of the voter. The votes are then always
+ * those of the fingerprints in the window, as if the window had been voted
+ * from scratch, but each fingerprint is looked up and voted only once
+ * however often the leaders are read.
+ *
+ * Frames lost from the stream are passed over with skip(), which moves the
+ * window on over them. The window always ends at the newest anchor time
+ * seen or skipped to, so anchors pushed after a skip() from before the gap,
+ * which fingerprinting holds back for a while, only count while they are
+ * still within it.
+ *
+ * Anchor times are 16 bit frame numbers and wrap, so the window must be
+ * shorter than 2^15 frames.
+ */
+
+#ifndef _SLIDING_VOTER_H
+#define _SLIDING_VOTER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "shazam.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+#include "offset_voter.h"
+
+class sliding_voter {
+public:
+	sliding_voter(uint16_t window, unsigned min_anchor_votes = VOTE_ANCHOR_MIN,
+		unsigned tolerance = VOTE_TOLERANCE)
+		: window(window), min_anchor_votes(min_anchor_votes), tolerance(tolerance),
+		voter(min_anchor_votes, tolerance), head(0), anchor_head(0), newest(0),
+		started(false), in_window(0) {}
+
+	void reserve(size_t songs_count, uint16_t max_song_ID)
+	{
+		voter.reserve(songs_count, max_song_ID);
+	}
+
+	/* Forgets the stream, e.g. after a gap in the audio */
+	void reset()
+	{
+		voter.reset();
+		hits.clear();
+		anchors.clear();
+		head = 0;
+		anchor_head = 0;
+		started = false;
+		in_window = 0;
+	}
+
+	/*
+	 * Moves the window on over count frames lost after the newest anchor,
+	 * taking back the votes of the fingerprints that leave it.
+	 */
+	void skip(uint32_t count)
+	{
+		if (!count || !started)
+			return;
+		if (count >= window) {
+			reset();
+			return;
+		}
+		newest += count;
+		expire();
+	}
+
+	/*
+	 * Votes count fingerprints that follow those already pushed, then
+	 * takes back the votes of the fingerprints that left the window.
+	 */
+	void push(const fingerprint_record * prints, size_t count,
+		const fingerprint_index & database)
+	{
+		for (size_t i = 0, j; i < count; i = j) {
+			uint16_t time = prints[i].time;
+			for (j = i; j < count && prints[j].time == time; j++)
+				;
+			vote_anchor(prints + i, j - i, database);
+			if (!started || (int16_t) (time - newest) > 0)
+				newest = time;
+			started = true;
+		}
+		if (count)
+			expire();
+	}
+
+	void push(const std::vector<fingerprint_record> & prints,
+		const fingerprint_index & database)
+	{
+		push(prints.empty() ? NULL : &prints[0], prints.size(), database);
+	}
+
+	/* Writes the k songs with the most votes in the window to out, best first */
+	void leaders(size_t k, std::vector<offset_match> & out) const
+	{
+		voter.leaders(k, out);
+	}
+
+	/* Fingerprints in the window */
+	size_t fingerprints() const { return in_window; }
+
+	/*
+	 * Writes the anchor times in the window that voted for song_ID at
+	 * offset, or within the tolerance of it, to out, oldest first and each
+	 * once: where in the window the song is heard. Goes through every hit
+	 * in the window, so is for the odd query, not for every push.
+	 */
+	void anchor_times(uint16_t song_ID, uint16_t offset,
+		std::vector<uint16_t> & out) const
+	{
+		out.clear();
+		for (size_t i = head; i < hits.size(); i++) {
+			const window_hit & h = hits[i];
+			if (h.song_ID == song_ID
+				&& (uint16_t) (h.offset - offset + tolerance) <= 2 * tolerance
+				&& (out.empty() || out.back() != h.time))
+				out.push_back(h.time);
+		}
+	}
+
+private:
+	struct window_hit {
+		uint16_t time;		/* sample anchor time */
+		uint16_t song_ID;
+		uint16_t offset;
+		uint16_t votes;
+	};
+
+	/* Anchor time and fingerprint count, to keep fingerprints() */
+	struct window_anchor {
+		uint16_t time;
+		uint16_t prints;
+	};
+
+	/* Votes the fingerprints of one anchor, as offset_voter::vote does */
+	void vote_anchor(const fingerprint_record * prints, size_t count,
+		const fingerprint_index & database)
+	{
+		uint16_t time = prints[0].time;
+		window_anchor a = {time, (uint16_t) count};
+		anchors.push_back(a);
+		in_window += count;
+
+		if (min_anchor_votes <= 1) {
+			for (size_t i = 0; i < count; i++) {
+				posting_span span = database.lookup(prints[i].hash);
+				for (auto it = span.begin(); it != span.end(); ++it)
+					keep(time, it->song_ID, it->time_pt - time, 1);
+			}
+			return;
+		}
+
+		anchor_hits.clear();
+		for (size_t i = 0; i < count; i++) {
+			posting_span span = database.lookup(prints[i].hash);
+			for (auto it = span.begin(); it != span.end(); ++it)
+				anchor_hits.push_back((uint32_t) it->song_ID << 16 | it->time_pt);
+		}
+		std::sort(anchor_hits.begin(), anchor_hits.end());
+		for (size_t h = 0, k; h < anchor_hits.size(); h = k) {
+			for (k = h; k < anchor_hits.size() && anchor_hits[k] == anchor_hits[h]; k++)
+				;
+			if (k - h >= min_anchor_votes)
+				keep(time, anchor_hits[h] >> 16,
+					(uint16_t) anchor_hits[h] - time, k - h);
+		}
+	}
+
+	void keep(uint16_t time, uint16_t song_ID, uint16_t offset, uint32_t votes)
+	{
+		window_hit h = {time, song_ID, offset, (uint16_t) votes};
+		voter.add(song_ID, offset, votes);
+		hits.push_back(h);
+	}
+
+	bool expired(uint16_t time) const
+	{
+		return (uint16_t) (newest - time) >= window;
+	}
+
+	void expire()
+	{
+		while (head < hits.size() && expired(hits[head].time)) {
+			voter.remove(hits[head].song_ID, hits[head].offset, hits[head].votes);
+			head++;
+		}
+		while (anchor_head < anchors.size() && expired(anchors[anchor_head].time))
+			in_window -= anchors[anchor_head++].prints;
+
+		/* drop the expired front once it is half the queue */
+		if (head > hits.size() / 2) {
+			hits.erase(hits.begin(), hits.begin() + head);
+			head = 0;
+		}
+		if (anchor_head > anchors.size() / 2) {
+			anchors.erase(anchors.begin(), anchors.begin() + anchor_head);
+			anchor_head = 0;
+		}
+	}
+
+	uint16_t window;
+	unsigned min_anchor_votes;
+	unsigned tolerance;
+	offset_voter voter;
+	std::vector<window_hit> hits;		/* voted, oldest first from head */
+	std::vector<window_anchor> anchors;	/* likewise, from anchor_head */
+	std::vector<uint32_t> anchor_hits;
+	size_t head;
+	size_t anchor_head;
+	uint16_t newest;	/* newest anchor time pushed or skipped to */
+	bool started;		/* newest is set */
+	size_t in_window;	/* fingerprints in the window */
+};
+
+#endif
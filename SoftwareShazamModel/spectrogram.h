@@ -0,0 +1,497 @@
+/*
+ * Spectrogram storage.
+ *
+ * In memory a spectrogram is one contiguous, 64 byte aligned block of
+ * frames (frame-major: all the bins of one time step are adjacent), each
+ * frame holding only the low `width` bins the peak picker looks at.
+ * Functions take a spectrogram_view, so nothing is copied when a
+ * spectrogram is passed around.
+ *
+ * A .magspec/.realspec file is the binary twin of the text .mag/.real
+ * files written by fft.py: a fixed 64 byte header followed by the frames,
+ * one after another, each frame holding `bins` samples of the same type.
+ * The data starts on a 64 byte boundary so a mapped file can be read in
+ * place.
+ */
+
+#ifndef _SPECTROGRAM_H
+#define _SPECTROGRAM_H
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SPECTROGRAM_MAGIC "SPEC"
+#define SPECTROGRAM_VERSION 1
+#define SPECTROGRAM_EXT "spec"
+#define SPECTROGRAM_ALIGN 64
+
+enum spectrogram_sample_type {
+	SPEC_FLOAT32 = 0,
+	SPEC_INT32 = 1	/* fixed point, scaled by 2^frac_bits */
+};
+
+struct spectrogram_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t sample_type;
+	uint32_t nfft;
+	uint32_t hop;
+	uint32_t sample_rate;
+	uint32_t bins;		/* samples per frame */
+	uint32_t frames;
+	uint32_t frac_bits;
+	uint32_t data_offset;	/* bytes from start of file to frame 0 */
+	uint8_t reserved[28];
+};
+
+static_assert(sizeof(spectrogram_header) == 64,
+	"spectrogram_header is part of the file format");
+
+/* Read-only mapping of a binary spectrogram file */
+class spectrogram_file {
+public:
+	spectrogram_file() : base(NULL), length(0), hdr(NULL) {}
+	~spectrogram_file() { close(); }
+
+	bool open(const std::string & filename)
+	{
+		struct stat st;
+		int fd;
+
+		close();
+		fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd == -1)
+			return false;
+		if (fstat(fd, &st) || st.st_size < (off_t) sizeof(spectrogram_header)) {
+			::close(fd);
+			return false;
+		}
+		length = st.st_size;
+		base = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (base == MAP_FAILED) {
+			base = NULL;
+			return false;
+		}
+
+		hdr = (const spectrogram_header *) base;
+		if (memcmp(hdr->magic, SPECTROGRAM_MAGIC, 4)
+			|| hdr->version != SPECTROGRAM_VERSION
+			|| (hdr->sample_type != SPEC_FLOAT32 && hdr->sample_type != SPEC_INT32)
+			|| hdr->frac_bits >= 32
+			|| hdr->data_offset < sizeof(spectrogram_header)
+			|| hdr->data_offset > length
+			/* frames * bins * 4 bytes, divided out so it can't overflow */
+			|| (hdr->bins && hdr->frames > (length - hdr->data_offset) / 4 / hdr->bins)) {
+			std::cerr << filename << ": not a valid spectrogram file" << std::endl;
+			close();
+			return false;
+		}
+		madvise(base, length, MADV_SEQUENTIAL);
+		return true;
+	}
+
+	void close()
+	{
+		if (base)
+			munmap(base, length);
+		base = NULL;
+		length = 0;
+		hdr = NULL;
+	}
+
+	bool is_open() const { return base != NULL; }
+	const spectrogram_header & header() const { return *hdr; }
+	uint32_t frames() const { return hdr->frames; }
+	uint32_t bins() const { return hdr->bins; }
+
+	/* Only valid for SPEC_FLOAT32 files */
+	const float * frame(uint32_t t) const
+	{
+		return (const float *) ((const char *) base + hdr->data_offset)
+			+ (size_t) t * hdr->bins;
+	}
+
+	/* Only valid for SPEC_INT32 files */
+	const int32_t * fixed_frame(uint32_t t) const
+	{
+		return (const int32_t *) ((const char *) base + hdr->data_offset)
+			+ (size_t) t * hdr->bins;
+	}
+
+	/* Copy `count` samples of frame t into dst as floats */
+	void read_frame(uint32_t t, float * dst, uint32_t count) const
+	{
+		if (hdr->sample_type == SPEC_FLOAT32) {
+			memcpy(dst, frame(t), count * sizeof(float));
+		} else {
+			const int32_t * src = fixed_frame(t);
+			float scale = 1.0f / (float) (1u << hdr->frac_bits);
+			for (uint32_t i = 0; i < count; i++)
+				dst[i] = (float) src[i] * scale;
+		}
+	}
+
+private:
+	spectrogram_file(const spectrogram_file &);
+	spectrogram_file & operator=(const spectrogram_file &);
+
+	void * base;
+	size_t length;
+	const spectrogram_header * hdr;
+};
+
+inline spectrogram_header make_spectrogram_header(uint32_t nfft, uint32_t hop,
+	uint32_t sample_rate, uint32_t bins, uint32_t frames,
+	spectrogram_sample_type type = SPEC_FLOAT32, uint32_t frac_bits = 0)
+{
+	spectrogram_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SPECTROGRAM_MAGIC, 4);
+	hdr.version = SPECTROGRAM_VERSION;
+	hdr.sample_type = type;
+	hdr.nfft = nfft;
+	hdr.hop = hop;
+	hdr.sample_rate = sample_rate;
+	hdr.bins = bins;
+	hdr.frames = frames;
+	hdr.frac_bits = frac_bits;
+	hdr.data_offset = sizeof(spectrogram_header);
+	return hdr;
+}
+
+/* Writes hdr followed by hdr.frames * hdr.bins samples from data */
+inline bool write_spectrogram(const std::string & filename,
+	const spectrogram_header & hdr, const void * data)
+{
+	FILE * fout;
+	size_t size;
+	bool ok;
+
+	fout = fopen(filename.c_str(), "wb");
+	if (!fout) {
+		std::cerr << "could not open " << filename << std::endl;
+		return false;
+	}
+	size = (size_t) hdr.frames * hdr.bins * 4;
+	ok = fwrite(&hdr, sizeof(hdr), 1, fout) == 1
+		&& (size == 0 || fwrite(data, size, 1, fout) == 1);
+	ok = fclose(fout) == 0 && ok;
+	return ok;
+}
+
+/*
+ * Parses a text spectrogram (one frame per line, whitespace separated
+ * values) into frame-major floats. Short lines are zero padded.
+ * Returns the number of frames read, or -1 if the file can't be opened.
+ */
+inline long parse_text_spectrogram(const std::string & filename,
+	uint32_t bins, std::vector<float> & frames)
+{
+	FILE * fin;
+	std::vector<char> text;
+	char * p;
+	char * end;
+	long count = 0;
+
+	fin = fopen(filename.c_str(), "rb");
+	if (!fin)
+		return -1;
+	fseek(fin, 0, SEEK_END);
+	text.resize(ftell(fin) + 1);
+	fseek(fin, 0, SEEK_SET);
+	text.resize(fread(&text[0], 1, text.size() - 1, fin) + 1);
+	text.back() = '\0';
+	fclose(fin);
+
+	frames.clear();
+	p = &text[0];
+	while (*p) {
+		char * eol = strchr(p, '\n');
+		uint32_t i = 0;
+
+		if (eol)
+			*eol = '\0';
+		while (*p == ' ' || *p == '\t' || *p == '\r')
+			p++;
+		if (*p) {
+			frames.resize(frames.size() + bins, 0.0f);
+			float * frame = &frames[frames.size() - bins];
+			while (i < bins) {
+				float v = strtof(p, &end);
+				if (end == p)
+					break;
+				frame[i++] = v;
+				p = end;
+			}
+			count++;
+		}
+		if (!eol)
+			break;
+		p = eol + 1;
+	}
+	return count;
+}
+
+/* Non-owning, read-only view of frame-major spectrogram data */
+struct spectrogram_view {
+	const float * data;
+	uint32_t frames;
+	uint32_t width;		/* bins per frame */
+	uint32_t stride;	/* floats from one frame to the next */
+
+	const float * frame(uint32_t t) const { return data + (size_t) t * stride; }
+	float at(uint32_t t, uint32_t bin) const { return frame(t)[bin]; }
+};
+
+/*
+ * A spectrogram that owns its frames, either in an aligned heap block or
+ * in a mapped binary spectrogram file. Move only.
+ */
+class spectrogram {
+public:
+	spectrogram() : storage(NULL), mapped(NULL), base(NULL), n_frames(0),
+		n_width(0), n_stride(0), capacity(0) {}
+
+	explicit spectrogram(uint32_t width, uint32_t reserve_frames = 0)
+		: storage(NULL), mapped(NULL), base(NULL), n_frames(0),
+		n_width(width), n_stride(round_stride(width)), capacity(0)
+	{
+		reserve(reserve_frames);
+	}
+
+	spectrogram(spectrogram && other) : storage(NULL), mapped(NULL)
+	{
+		take(other);
+	}
+
+	spectrogram & operator=(spectrogram && other)
+	{
+		if (this != &other) {
+			release();
+			take(other);
+		}
+		return *this;
+	}
+
+	~spectrogram() { release(); }
+
+	uint32_t frames() const { return n_frames; }
+	uint32_t width() const { return n_width; }
+	uint32_t stride() const { return n_stride; }
+	bool empty() const { return n_frames == 0; }
+
+	const float * frame(uint32_t t) const { return base + (size_t) t * n_stride; }
+	float * frame(uint32_t t)
+	{
+		if (mapped)
+			unmap();
+		return storage + (size_t) t * n_stride;
+	}
+
+	spectrogram_view view() const
+	{
+		spectrogram_view v = { base, n_frames, n_width, n_stride };
+		return v;
+	}
+
+	operator spectrogram_view() const { return view(); }
+
+	void reserve(uint32_t frames)
+	{
+		float * grown;
+
+		if (mapped)
+			unmap();
+		if (frames <= capacity)
+			return;
+		grown = allocate(frames);
+		if (n_frames)
+			memcpy(grown, storage, (size_t) n_frames * n_stride * sizeof(float));
+		free(storage);
+		storage = grown;
+		base = storage;
+		capacity = frames;
+	}
+
+	/* Appends a frame, copying its first width() bins */
+	float * push_frame(const float * src)
+	{
+		if (mapped)
+			unmap();
+		if (n_frames == capacity)
+			reserve(std::max(capacity * 2, (uint32_t) 64));
+		float * dst = frame(n_frames++);
+		if (src)
+			memcpy(dst, src, n_width * sizeof(float));
+		return dst;
+	}
+
+	void clear()
+	{
+		if (mapped) {
+			delete mapped;
+			mapped = NULL;
+			n_stride = round_stride(n_width);
+			base = storage;
+		}
+		n_frames = 0;
+	}
+
+	/*
+	 * Loads frames [offset, offset + length) of a binary spectrogram file.
+	 * Float files are used in place; fixed point files are converted.
+	 */
+	bool load_binary(const std::string & filename, uint32_t width,
+		uint32_t offset = 0, uint32_t length = UINT32_MAX)
+	{
+		spectrogram_file * file = new spectrogram_file;
+		uint32_t end;
+
+		if (!file->open(filename) || file->bins() < width) {
+			if (file->is_open())
+				std::cerr << filename << ": expected " << width
+					<< " bins, found " << file->bins() << std::endl;
+			delete file;
+			return false;
+		}
+
+		release();
+		end = file->frames();
+		offset = std::min(offset, end);
+		if (length < end - offset)
+			end = offset + length;
+		n_width = width;
+
+		if (file->header().sample_type == SPEC_FLOAT32) {
+			mapped = file;
+			base = file->frame(offset);
+			n_stride = file->bins();
+			n_frames = end - offset;
+			return true;
+		}
+
+		n_stride = round_stride(width);
+		reserve(end - offset);
+		for (uint32_t t = offset; t < end; t++)
+			file->read_frame(t, push_frame(NULL), width);
+		delete file;
+		return true;
+	}
+
+private:
+	spectrogram(const spectrogram &);
+	spectrogram & operator=(const spectrogram &);
+
+	static uint32_t round_stride(uint32_t width)
+	{
+		const uint32_t per_line = SPECTROGRAM_ALIGN / sizeof(float);
+		return (width + per_line - 1) / per_line * per_line;
+	}
+
+	float * allocate(uint32_t frames)
+	{
+		void * p;
+		if (posix_memalign(&p, SPECTROGRAM_ALIGN,
+				std::max((size_t) frames * n_stride * sizeof(float), (size_t) 1)))
+			throw std::bad_alloc();
+		return (float *) p;
+	}
+
+	/* Copies the mapped frames we were viewing into our own storage */
+	void unmap()
+	{
+		uint32_t src_stride = n_stride;
+
+		n_stride = round_stride(n_width);
+		if (capacity < n_frames) {
+			free(storage);
+			capacity = std::max(n_frames, (uint32_t) 64);
+			storage = allocate(capacity);
+		}
+		for (uint32_t t = 0; t < n_frames; t++)
+			memcpy(storage + (size_t) t * n_stride,
+				base + (size_t) t * src_stride, n_width * sizeof(float));
+		base = storage;
+		delete mapped;
+		mapped = NULL;
+	}
+
+	void release()
+	{
+		delete mapped;
+		free(storage);
+		storage = NULL;
+		mapped = NULL;
+		base = NULL;
+		n_frames = 0;
+		capacity = 0;
+	}
+
+	void take(spectrogram & other)
+	{
+		storage = other.storage;
+		mapped = other.mapped;
+		base = other.base;
+		n_frames = other.n_frames;
+		n_width = other.n_width;
+		n_stride = other.n_stride;
+		capacity = other.capacity;
+		other.storage = NULL;
+		other.mapped = NULL;
+		other.base = NULL;
+		other.n_frames = 0;
+		other.capacity = 0;
+	}
+
+	float * storage;
+	spectrogram_file * mapped;
+	const float * base;
+	uint32_t n_frames;
+	uint32_t n_width;
+	uint32_t n_stride;
+	uint32_t capacity;
+};
+
+/*
+ * Reads frames [offset, offset + length) of a spectrogram, keeping the low
+ * `width` bins. Uses the binary twin filename + "spec" when it exists and
+ * otherwise parses the text file, which has `bins` values per line.
+ */
+inline spectrogram read_spectrogram(const std::string & filename,
+	uint32_t bins, uint32_t width, uint32_t offset = 0,
+	uint32_t length = UINT32_MAX)
+{
+	spectrogram spec(width);
+	std::vector<float> text;
+	long count;
+
+	if (spec.load_binary(filename + SPECTROGRAM_EXT, width, offset, length))
+		return spec;
+
+	count = parse_text_spectrogram(filename, bins, text);
+	if (count < 0)
+		return spec;
+	uint32_t end = (uint32_t) count;
+	offset = std::min(offset, end);
+	if (length < end - offset)
+		end = offset + length;
+	spec.reserve(end - offset);
+	for (uint32_t t = offset; t < end; t++)
+		spec.push_frame(&text[(size_t) t * bins]);
+	return spec;
+}
+
+#endif
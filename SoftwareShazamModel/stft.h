@@ -0,0 +1,372 @@
+/*
+ * Short-time Fourier transform of a WAV file, the C++ replacement for
+ * generateFFT in fft.py.
+ *
+ * Frames are NFFT samples long with a hop of NFFT/2 and no window, and
+ * for every frame the first NFFT/2 bins of |X| (the .mag file) and |Re X|
+ * (the .real file) are produced, exactly like fft.py. Each frame is a
+ * real-input FFT: the NFFT samples are packed into an NFFT/2 point complex
+ * FFT whose output is split back into the real spectrum. The complex FFT
+ * is radix-2 on split real/imaginary arrays with per-stage twiddle tables,
+ * so from the third stage on the butterflies run four at a time.
+ */
+
+#ifndef _STFT_H
+#define _STFT_H
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+/*
+ * Reads a PCM (8/16/24/32 bit integer or 32 bit float) WAV file a block
+ * at a time, mixed down the same way fft.py does: stereo files average the
+ * two channels, mono files average consecutive pairs of samples. Only the
+ * block being read is held in memory, so recordings of any length can be
+ * streamed, and seek() lets several readers take a part each.
+ */
+class wav_reader {
+public:
+	wav_reader() : fin(NULL), data_start(0), count(0), format(0), channels(0),
+		bits(0), sample_rate(0) {}
+	~wav_reader() { close(); }
+
+	/* Returns false, with a message, if the file can't be read */
+	bool open(const std::string & filename)
+	{
+		char id[4];
+		uint32_t size;
+		bool have_fmt = false;
+		bool have_data = false;
+
+		close();
+		fin = fopen(filename.c_str(), "rb");
+		if (!fin) {
+			std::cerr << "could not open " << filename << std::endl;
+			return false;
+		}
+		if (fread(id, 1, 4, fin) != 4 || memcmp(id, "RIFF", 4)
+			|| fread(&size, 4, 1, fin) != 1
+			|| fread(id, 1, 4, fin) != 4 || memcmp(id, "WAVE", 4)) {
+			std::cerr << filename << ": not a WAV file" << std::endl;
+			close();
+			return false;
+		}
+
+		while (fread(id, 1, 4, fin) == 4 && fread(&size, 4, 1, fin) == 1) {
+			if (!memcmp(id, "fmt ", 4)) {
+				uint8_t fmt[16];
+				if (size < 16 || fread(fmt, 1, 16, fin) != 16)
+					break;
+				memcpy(&format, fmt, 2);
+				memcpy(&channels, fmt + 2, 2);
+				memcpy(&sample_rate, fmt + 4, 4);
+				memcpy(&bits, fmt + 14, 2);
+				/* WAVE_FORMAT_EXTENSIBLE keeps the real format in the subformat */
+				if (format == 0xFFFE && size >= 26) {
+					uint8_t ext[10];
+					if (fread(ext, 1, 10, fin) != 10)
+						break;
+					memcpy(&format, ext + 8, 2);
+					size -= 10;
+				}
+				fseek(fin, size - 16 + (size & 1), SEEK_CUR);
+				have_fmt = true;
+			} else if (!memcmp(id, "data", 4)) {
+				/* a truncated file has less data than its header says */
+				data_start = ftell(fin);
+				fseek(fin, 0, SEEK_END);
+				long end = ftell(fin);
+				size_t bytes = end > data_start
+					? std::min((size_t) size, (size_t) (end - data_start)) : 0;
+				fseek(fin, data_start, SEEK_SET);
+				have_data = true;
+				count = bytes;
+				break;
+			} else {
+				fseek(fin, size + (size & 1), SEEK_CUR);
+			}
+		}
+
+		if (!have_fmt || channels == 0 || (format != 1 && format != 3)
+			|| (format == 3 && bits != 32)
+			|| (bits != 8 && bits != 16 && bits != 24 && bits != 32)) {
+			std::cerr << filename << ": unsupported WAV format" << std::endl;
+			close();
+			return false;
+		}
+		count = have_data ? count / (bits / 8) / stride() : 0;
+		return true;
+	}
+
+	void close()
+	{
+		if (fin)
+			fclose(fin);
+		fin = NULL;
+		count = 0;
+	}
+
+	uint32_t rate() const { return sample_rate; }
+
+	/* Samples after mixing down */
+	size_t length() const { return count; }
+
+	/* Makes the next read() start at mixed down sample `sample` */
+	bool seek(size_t sample)
+	{
+		return sample <= count && !fseek(fin, data_start
+			+ (long) (sample * stride() * (bits / 8)), SEEK_SET);
+	}
+
+	/*
+	 * Reads up to n mixed down samples into out, returning how many were
+	 * read: fewer than n only at the end of the data.
+	 */
+	size_t read(float * out, size_t n)
+	{
+		size_t width = bits / 8;
+		size_t done = 0;
+
+		while (done < n) {
+			size_t block = std::min(n - done, (size_t) 4096);
+			raw.resize(block * stride() * width);
+			size_t got = fread(&raw[0], stride() * width, block, fin);
+			for (size_t i = 0; i < got; i++) {
+				const uint8_t * p = &raw[i * stride() * width];
+				/* a mono sample and the next, or the first two channels */
+				out[done + i] = (sample(p) + sample(p + width)) * 0.5f;
+			}
+			done += got;
+			if (got < block)
+				break;
+		}
+		return done;
+	}
+
+private:
+	wav_reader(const wav_reader &);
+	wav_reader & operator=(const wav_reader &);
+
+	/* Raw samples per mixed down sample */
+	size_t stride() const { return channels == 1 ? 2 : channels; }
+
+	float sample(const uint8_t * p) const
+	{
+		if (format == 3) {
+			float v;
+			memcpy(&v, p, 4);
+			return v;
+		} else if (bits == 8) {
+			return (float) p[0] - 128.0f;
+		} else if (bits == 16) {
+			return (float) (int16_t) (p[0] | p[1] << 8);
+		} else if (bits == 24) {
+			return (float) ((int32_t) ((uint32_t) p[0] << 8
+				| (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24) >> 8);
+		}
+		int32_t v;
+		memcpy(&v, p, 4);
+		return (float) v;
+	}
+
+	FILE * fin;
+	long data_start;
+	size_t count;		/* mixed down samples */
+	uint16_t format;
+	uint16_t channels;
+	uint16_t bits;
+	uint32_t sample_rate;
+	std::vector<uint8_t> raw;
+};
+
+/*
+ * Reads a whole WAV file with a wav_reader.
+ * Returns false if the file can't be read.
+ */
+inline bool read_wav(const std::string & filename, std::vector<float> & signal,
+	uint32_t & sample_rate)
+{
+	wav_reader wav;
+
+	if (!wav.open(filename))
+		return false;
+	sample_rate = wav.rate();
+	signal.resize(wav.length());
+	signal.resize(wav.read(signal.empty() ? NULL : &signal[0], signal.size()));
+	return true;
+}
+
+/* 4 lane float vector: SSE on x86, NEON on the board's ARM */
+typedef float stft_v4sf __attribute__((vector_size(16)));
+
+class stft_engine {
+public:
+	/* nfft must be a power of two, at least 16 */
+	explicit stft_engine(int nfft) : n(nfft), m(nfft/2)
+	{
+		int log2m = 0;
+		while ((1 << log2m) < m)
+			log2m++;
+
+		bitrev.resize(m);
+		for (int i = 0; i < m; i++) {
+			int r = 0;
+			for (int b = 0; b < log2m; b++)
+				if (i & (1 << b))
+					r |= 1 << (log2m - 1 - b);
+			bitrev[i] = r;
+		}
+
+		/* twiddles for the stage with half size h live at [h, 2h) */
+		tw_re.resize(m);
+		tw_im.resize(m);
+		for (int h = 1; h < m; h <<= 1) {
+			for (int k = 0; k < h; k++) {
+				double a = -M_PI * k / h;
+				tw_re[h + k] = (float) cos(a);
+				tw_im[h + k] = (float) sin(a);
+			}
+		}
+
+		/* twiddles W_n^k used to split the packed transform */
+		split_re.resize(m);
+		split_im.resize(m);
+		for (int k = 0; k < m; k++) {
+			double a = -2.0 * M_PI * k / n;
+			split_re[k] = (float) cos(a);
+			split_im[k] = (float) sin(a);
+		}
+
+		z_re.resize(m);
+		z_im.resize(m);
+	}
+
+	int size() const { return n; }
+
+	/*
+	 * Transforms n real samples. mag and real receive n/2 bins each, either
+	 * may be NULL.
+	 */
+	void transform(const float * in, float * mag, float * real)
+	{
+		float * zr = &z_re[0];
+		float * zi = &z_im[0];
+
+		/* pack even samples as real, odd samples as imaginary part */
+		for (int i = 0; i < m; i++) {
+			zr[bitrev[i]] = in[2*i];
+			zi[bitrev[i]] = in[2*i + 1];
+		}
+
+		/* the first two stages have fewer than 4 butterflies per block */
+		for (int h = 1; h < m && h < 4; h <<= 1) {
+			for (int s = 0; s < m; s += 2*h) {
+				for (int k = 0; k < h; k++) {
+					float wr = tw_re[h + k], wi = tw_im[h + k];
+					int a = s + k, b = s + k + h;
+					float tr = zr[b]*wr - zi[b]*wi;
+					float ti = zr[b]*wi + zi[b]*wr;
+					zr[b] = zr[a] - tr;
+					zi[b] = zi[a] - ti;
+					zr[a] = zr[a] + tr;
+					zi[a] = zi[a] + ti;
+				}
+			}
+		}
+		for (int h = 4; h < m; h <<= 1) {
+			for (int s = 0; s < m; s += 2*h) {
+				for (int k = 0; k < h; k += 4) {
+					stft_v4sf wr = load4(&tw_re[h + k]);
+					stft_v4sf wi = load4(&tw_im[h + k]);
+					stft_v4sf ar = load4(zr + s + k);
+					stft_v4sf ai = load4(zi + s + k);
+					stft_v4sf br = load4(zr + s + h + k);
+					stft_v4sf bi = load4(zi + s + h + k);
+					stft_v4sf tr = br*wr - bi*wi;
+					stft_v4sf ti = br*wi + bi*wr;
+					store4(zr + s + h + k, ar - tr);
+					store4(zi + s + h + k, ai - ti);
+					store4(zr + s + k, ar + tr);
+					store4(zi + s + k, ai + ti);
+				}
+			}
+		}
+
+		/*
+		 * X[k] = E[k] + W^k O[k] with
+		 * E[k] = (Z[k] + conj(Z[m-k]))/2, O[k] = (Z[k] - conj(Z[m-k]))/2i
+		 */
+		for (int k = 0; k < m; k++) {
+			int j = k ? m - k : 0;
+			float er = 0.5f * (zr[k] + zr[j]);
+			float ei = 0.5f * (zi[k] - zi[j]);
+			float or_ = 0.5f * (zi[k] + zi[j]);
+			float oi = -0.5f * (zr[k] - zr[j]);
+			float xr = er + split_re[k]*or_ - split_im[k]*oi;
+			float xi = ei + split_re[k]*oi + split_im[k]*or_;
+			if (mag)
+				mag[k] = sqrtf(xr*xr + xi*xi);
+			if (real)
+				real[k] = fabsf(xr);
+		}
+	}
+
+private:
+	static stft_v4sf load4(const float * p)
+	{
+		stft_v4sf v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	static void store4(float * p, stft_v4sf v)
+	{
+		memcpy(p, &v, sizeof(v));
+	}
+
+	int n;
+	int m;
+	std::vector<int> bitrev;
+	std::vector<float> tw_re, tw_im;
+	std::vector<float> split_re, split_im;
+	std::vector<float> z_re, z_im;
+};
+
+/* Number of frames fft.py produces for a signal of `length` samples */
+inline size_t stft_frames(size_t length, int nfft)
+{
+	size_t usable = length - length % nfft;
+	return usable < (size_t) nfft ? 0 : (usable - nfft) / (nfft/2) + 1;
+}
+
+/*
+ * Runs the STFT over signal, hop nfft/2. mag and real (either may be NULL)
+ * are resized to frames * nfft/2, frame-major.
+ * Returns the number of frames.
+ */
+inline size_t compute_stft(const std::vector<float> & signal, int nfft,
+	std::vector<float> * mag, std::vector<float> * real)
+{
+	stft_engine engine(nfft);
+	size_t frames = stft_frames(signal.size(), nfft);
+	size_t bins = nfft/2;
+
+	if (mag)
+		mag->resize(frames * bins);
+	if (real)
+		real->resize(frames * bins);
+	for (size_t t = 0; t < frames; t++) {
+		engine.transform(&signal[t * bins],
+			mag ? &(*mag)[t * bins] : NULL,
+			real ? &(*real)[t * bins] : NULL);
+	}
+	return frames;
+}
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Checks that fingerprint_index holds each (key, song, time) posting once:
+ * a fingerprint added twice, in one add() or again after build(), gives a
+ * single posting, while the same key at another time or in another song
+ * is kept.
+ *
+ * Usage:
+ *   test_fingerprint_index
+ */
+
+#include <iostream>
+#include <vector>
+#include "shazam.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+
+static int failed = 0;
+
+static void check(bool ok, const char * what)
+{
+	std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+	failed |= !ok;
+}
+
+/* The postings of key, as song_ID << 16 | time_pt */
+static std::vector<uint32_t> postings(const fingerprint_index & db,
+	fingerprint_key key)
+{
+	std::vector<uint32_t> out;
+	posting_span span = db.lookup(key);
+	for (auto it = span.begin(); it != span.end(); ++it)
+		out.push_back((uint32_t) it->song_ID << 16 | it->time_pt);
+	return out;
+}
+
+int main()
+{
+	std::vector<fingerprint_record> prints;
+	fingerprint_index db;
+
+	for (uint32_t i = 0; i < 1000; i++) {
+		fingerprint_record r = {(fingerprint_key) (i * 2654435761u), (uint16_t) i};
+		prints.push_back(r);
+	}
+	fingerprint_record again = prints[10];
+	fingerprint_record later = {prints[10].hash, 2000};
+	prints.push_back(again);
+	prints.push_back(later);
+
+	db.add(prints, 1);
+	db.add(&again, 1, 2);
+	db.build();
+	std::vector<uint32_t> got = postings(db, again.hash);
+	check(db.size() == 1002 && got.size() == 3 && got[0] == (1u << 16 | 10)
+		&& got[1] == (1u << 16 | 2000) && got[2] == (2u << 16 | 10),
+		"holds a fingerprint added twice in one song once");
+
+	db.add(prints, 1);
+	db.build();
+	check(db.size() == 1002 && postings(db, again.hash) == got,
+		"holds a song added again after build() once");
+
+	return failed;
+}
@@ -0,0 +1,106 @@
+/*
+ * Checks that identifying with a warmed up query_context does no heap
+ * allocation, with one voting thread and with several.
+ *
+ * Usage:
+ *   test_query_context <constellation dir>
+ *
+ * The database and the samples are read like benchmark index does: the
+ * songs of dir/song_list.txt from <song>_48.magpeak, the samples from
+ * <song>_NOISY_48.magpeak.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <list>
+#include <vector>
+#include <new>
+#include "shazam.h"
+#include "constellation.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+#include "query_context.h"
+
+static size_t allocations = 0;
+
+void * operator new(size_t size)
+{
+	void * p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	allocations++;
+	return p;
+}
+
+void operator delete(void * p) noexcept
+{
+	free(p);
+}
+
+int main(int argc, char ** argv)
+{
+	std::list<database_info> songs;
+	std::vector<std::vector<fingerprint_record> > samples;
+	std::vector<fingerprint_record> prints;
+	std::vector<peak> peaks;
+	fingerprint_index db;
+	std::fstream file;
+	std::string line;
+	uint16_t num_db = 0;
+	int failed = 0;
+
+	if (argc != 2) {
+		std::cerr << "usage: test_query_context <constellation dir>" << std::endl;
+		return 1;
+	}
+	std::string dir = argv[1];
+
+	file.open((dir + "/song_list.txt").c_str());
+	while (getline(file, line)) {
+		if (line.empty())
+			continue;
+		num_db++;
+		if (!read_peak_file(dir + "/" + line + "_48.magpeak", peaks)) {
+			std::cerr << "could not read " << line << std::endl;
+			return 1;
+		}
+		generate_fingerprints(peaks, prints);
+		db.add(prints, num_db);
+		struct database_info info = {line, num_db, (int) prints.size()};
+		songs.push_back(info);
+
+		if (!read_peak_file(dir + "/" + line + "_NOISY_48.magpeak", peaks)) {
+			std::cerr << "could not read " << line << "_NOISY" << std::endl;
+			return 1;
+		}
+		generate_fingerprints(peaks, prints);
+		samples.push_back(prints);
+	}
+	file.close();
+	db.build();
+
+	unsigned thread_counts[] = {1, 4};
+	for (int i = 0; i < 2; i++) {
+		query_context query(songs, thread_counts[i]);
+		std::vector<std::string> first;
+
+		for (size_t s = 0; s < samples.size(); s++)
+			first.push_back(query.identify(samples[s], db)[0]->song);
+
+		size_t before = allocations;
+		bool same = true;
+		for (size_t s = 0; s < samples.size(); s++)
+			same = same && query.identify(samples[s], db)[0]->song == first[s];
+		size_t made = allocations - before;
+
+		std::cout << thread_counts[i] << " threads: " << made
+			<< " allocations in " << samples.size() << " queries" << std::endl;
+		if (made || !same) {
+			std::cout << "FAILED" << (same ? "" : ": results changed") << std::endl;
+			failed = 1;
+		}
+	}
+	return failed;
+}
@@ -0,0 +1,237 @@
+/*
+ * Captures the accelerator's frames on a thread of their own, so the
+ * device is read while earlier frames are peak picked and fingerprinted,
+ * and fingerprinting never holds up the device.
+ *
+ * The capture thread turns each frame into SPECTROGRAM_WIDTH magnitudes
+ * straight into a slot of a frame_queue, which the recognizer takes them
+ * from in place. The queue has one producer and one consumer, so it needs
+ * no lock: the capture thread alone moves head, the recognizer alone tail.
+ * A full queue drops the new frame and counts it, since the device won't
+ * wait either. A recognizer that finds the queue empty blocks on a
+ * condition variable the capture thread notifies after each frame it
+ * queues, and when the recording ends.
+ *
+ * Each frame comes with the gap before it: the frames lost since the one
+ * before it in the queue, whether the device made them unread or the
+ * queue dropped them, found from the device's time counter.
+ *
+ * Include after shazam.h and the parameters it is built with.
+ */
+
+#ifndef _CAPTURE_THREAD_H
+#define _CAPTURE_THREAD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "shazam.h"
+#include "fft_capture.h"
+
+#ifndef CAPTURE_QUEUE_FRAMES
+#define CAPTURE_QUEUE_FRAMES 1024	/* a power of 2, 5.5 s of audio */
+#endif
+
+struct captured_frame {
+	uint32_t time;		/* TIME_COUNT of the frame */
+	uint32_t gap;		/* frames lost just before it */
+	float magnitude[SPECTROGRAM_WIDTH];
+};
+
+class frame_queue {
+public:
+	frame_queue() : slots(CAPTURE_QUEUE_FRAMES) { clear(); }
+
+	/* Empties the queue and its counters, with neither end running */
+	void clear()
+	{
+		head.store(0);
+		tail.store(0);
+		peak.store(0);
+		dropped.store(0);
+	}
+
+	/* Producer: the slot for the next frame, or NULL if the queue is full */
+	captured_frame * next_slot()
+	{
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == CAPTURE_QUEUE_FRAMES)
+			return NULL;
+		return &slots[h % CAPTURE_QUEUE_FRAMES];
+	}
+
+	/* Producer: hands the frame written to next_slot()'s slot over */
+	void publish()
+	{
+		uint32_t h = head.load(std::memory_order_relaxed) + 1;
+		uint32_t queued = h - tail.load(std::memory_order_relaxed);
+		if (queued > peak.load(std::memory_order_relaxed))
+			peak.store(queued, std::memory_order_relaxed);
+		head.store(h, std::memory_order_release);
+	}
+
+	/* Producer: counts a frame there was no room for */
+	void drop() { dropped.fetch_add(1, std::memory_order_relaxed); }
+
+	/* Consumer: the oldest frame, or NULL if there is none */
+	const captured_frame * front() const
+	{
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if (head.load(std::memory_order_acquire) == t)
+			return NULL;
+		return &slots[t % CAPTURE_QUEUE_FRAMES];
+	}
+
+	/* Consumer: done with front()'s frame */
+	void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+	/* Frames queued now, and at most since clear() */
+	uint32_t size() const { return head.load() - tail.load(); }
+	uint32_t peak_size() const { return peak.load(std::memory_order_relaxed); }
+
+	/* Frames dropped since clear() */
+	uint64_t dropped_frames() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+	std::vector<captured_frame> slots;
+	alignas(64) std::atomic<uint32_t> head;		/* frames published */
+	alignas(64) std::atomic<uint32_t> tail;		/* frames taken */
+	alignas(64) std::atomic<uint32_t> peak;
+	std::atomic<uint64_t> dropped;
+};
+
+class capture_thread {
+public:
+	capture_thread() : running(false), stopping(false), device_failed(false),
+		missed_frames(0), gap_count(0), lost_frames(0) {}
+
+	~capture_thread() { stop(); }
+
+	/*
+	 * Starts a new recording from fd into an empty queue, of frames frames
+	 * or, if 0, until stop().
+	 */
+	void start(int fd, uint32_t frames = 0)
+	{
+		stop();
+		capture.restart();
+		queue.clear();
+		stopping.store(false);
+		device_failed.store(false);
+		missed_frames.store(0);
+		gap_count.store(0);
+		lost_frames.store(0);
+		running.store(true);
+		worker = std::thread(&capture_thread::run, this, fd, frames);
+	}
+
+	/* Ends the recording; frames already queued can still be taken */
+	void stop()
+	{
+		stopping.store(true);
+		if (worker.joinable())
+			worker.join();
+	}
+
+	/*
+	 * The oldest frame captured, waiting for one if there is none yet, or
+	 * NULL once the recording has ended and every frame has been taken.
+	 * It stays valid until pop().
+	 */
+	const captured_frame * next() const
+	{
+		const captured_frame * frame = queue.front();
+		if (frame)
+			return frame;
+		std::unique_lock<std::mutex> lock(wake_lock);
+		wake.wait(lock, [this] {
+			return queue.front() || !running.load(std::memory_order_acquire);
+		});
+		return queue.front();
+	}
+
+	/* Done with next()'s frame */
+	void pop() { queue.pop(); }
+
+	/* Whether the recording ended because the device failed */
+	bool failed() const { return device_failed.load(); }
+
+	/* Frames the device made that the capture thread didn't read */
+	uint64_t missed() const { return missed_frames.load(std::memory_order_relaxed); }
+
+	/* Frames read with the queue full */
+	uint64_t dropped() const { return queue.dropped_frames(); }
+
+	/* Gaps between the frames queued, and the frames lost in them */
+	uint64_t gaps() const { return gap_count.load(std::memory_order_relaxed); }
+	uint64_t lost() const { return lost_frames.load(std::memory_order_relaxed); }
+
+	/* Frames waiting in the queue now, and at most */
+	uint32_t queued() const { return queue.size(); }
+	uint32_t peak_queued() const { return queue.peak_size(); }
+
+private:
+	void run(int fd, uint32_t frames)
+	{
+		const float scale = 1.0f / (1 << AMPL_FRACTIONAL_BITS);
+		uint32_t gap = 0;	/* frames lost since the last one queued */
+
+		for (uint32_t n = 0; (!frames || n < frames) && !stopping.load(); n++) {
+			const fft_accelerator_fft_t * frame = capture.read(fd);
+			if (!frame || !frame->valid) {
+				device_failed.store(true);
+				break;
+			}
+			missed_frames.store(capture.missed(), std::memory_order_relaxed);
+			gap += capture.gap();
+			captured_frame * slot = queue.next_slot();
+			if (!slot) {
+				queue.drop();
+				gap++;
+				continue;
+			}
+			if (gap) {
+				gap_count.fetch_add(1, std::memory_order_relaxed);
+				lost_frames.fetch_add(gap, std::memory_order_relaxed);
+			}
+			slot->time = frame->time;
+			slot->gap = gap;
+			gap = 0;
+			for (int i = 0; i < SPECTROGRAM_WIDTH; i++)
+				slot->magnitude[i] = std::abs((float) frame->fft[i]) * scale;
+			queue.publish();
+			wake_consumer();
+		}
+		running.store(false, std::memory_order_release);
+		wake_consumer();
+	}
+
+	/*
+	 * Wakes next() if it is waiting. Taking the lock first means a next()
+	 * that missed the change is already waiting when notified.
+	 */
+	void wake_consumer()
+	{
+		{ std::lock_guard<std::mutex> lock(wake_lock); }
+		wake.notify_one();
+	}
+
+	fft_capture capture;
+	frame_queue queue;
+	std::thread worker;
+	mutable std::mutex wake_lock;
+	mutable std::condition_variable wake;
+	std::atomic<bool> running;
+	std::atomic<bool> stopping;
+	std::atomic<bool> device_failed;
+	std::atomic<uint64_t> missed_frames;
+	std::atomic<uint64_t> gap_count;
+	std::atomic<uint64_t> lost_frames;
+};
+
+#endif
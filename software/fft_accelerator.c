@@ -32,16 +32,23 @@
 #include <linux/of_address.h>
 #include <linux/fs.h>
 #include <linux/uaccess.h>
-#include "fft_accelerator.h"
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/hrtimer.h>
+
+#define fft_read32(addr)       ioread32(addr)
+#define fft_read8(addr)        ioread8(addr)
+#define fft_write8(val, addr)  iowrite8(val, addr)
+#include "fft_accelerator_regs.h"
 
 
 #define DRIVER_NAME "fft_accelerator"
 
-/* Device registers */
-#define AMPLITUDES(x)    (x) 
-#define TIME_COUNT(x)    (AMPLITUDES(x) + AMPLITUDES_SIZE)
-#define VALID(x)         (TIME_COUNT(x) + COUNTER_WIDTH_BYES) 
-#define READING(x)       (VALID(x) + 1)
+/* A device that makes no frame for this long has stopped */
+#define READ_TIMEOUT_MS 100
 
 /*
  * Information about our device
@@ -49,94 +56,279 @@
 struct fft_accelerator_dev {
 	struct resource res; /* Resource: our registers */
 	void __iomem *virtbase; /* Where registers can be accessed in memory */
+	struct mutex open_lock; /* Held while counting users and readers */
+	int users; /* Open files; the producer runs while there are any */
+	int fd_readers; /* Files that took frames with read() or an ioctl */
+	int mappings; /* Mappings of the ring */
+	struct hrtimer timer; /* Runs the producer */
+	struct fft_accelerator_reader reader; /* Producer state */
+	fft_accelerator_ring_t *ring; /* Frames, also mapped by mmap() */
+	fft_accelerator_fft_t spare; /* Frame read while the ring is full */
+	wait_queue_head_t wait; /* Readers waiting for a frame */
+	struct mutex lock; /* Held by read() and the ioctls taking frames */
+	uint32_t missed_seen; /* ring->missed at the last batch */
 } dev;
 
 
-// TODO rewrite this.  Right now it is a sketch. Double check subleties with bit widths,
-// and make sure addresses match with hardware.
-static int fft_accelerator_read_sample(fft_accelerator_fft_t *sample_struct) {
-	int i;
-	static uint32_t prev_time = 0;
-	
-	// THIS PART IS NOT FULLY PARAMETRIZED -- 
-	// ioread*() calls may need to change if bit widths change.
-	int tries = 0;
-	while (1) {
-		while ((sample_struct->time = ioread32(TIME_COUNT(dev.virtbase))) == prev_time) {
-			tries++;
-			if (tries > 15){
-				printk("\tSample time delta: %d\n", sample_struct->time - prev_time);
-				return -1;
-			}
-			usleep_range(1000, 2000);
-		}
-		iowrite8(0x1u, READING(dev.virtbase));
-		for (i = 0; i < N_FREQUENCIES; i++) {
-			sample_struct->fft[i] = ioread32(AMPLITUDES(dev.virtbase) + i*AMPL_WIDTH_BYTES);
+/*
+ * The producer: the accelerator has no interrupt, so a timer at twice the
+ * frame rate stands in for one, publishing each new frame in the ring and
+ * waking the readers. A tick reads a whole frame of registers, so the
+ * timer is a soft one, run in softirq context rather than with interrupts
+ * off.
+ */
+static enum hrtimer_restart fft_accelerator_tick(struct hrtimer *timer)
+{
+	if (fft_accelerator_produce(dev.virtbase, &dev.reader, dev.ring, &dev.spare))
+		wake_up_interruptible(&dev.wait);
+	hrtimer_forward_now(timer, ns_to_ktime(FFT_TICK_NS));
+	return HRTIMER_RESTART;
+}
+
+
+/*
+ * Copies up to count frames from the ring to dst, sleeping until there is
+ * a first one, and if all is set until there are count. Called with
+ * dev.lock held.
+ * Returns the number of frames copied, or an error if there were none.
+ */
+static long fft_accelerator_take(fft_accelerator_fft_t __user *dst,
+				 uint32_t count, int all, int nonblock)
+{
+	fft_accelerator_slot_t *slot;
+	uint32_t taken = 0;
+	long ret;
+
+	while (taken < count) {
+		slot = fft_ring_peek(dev.ring);
+		if (!slot) {
+			if (taken && !all)
+				break;
+			if (nonblock)
+				return taken ? taken : -EAGAIN;
+			ret = wait_event_interruptible_timeout(dev.wait,
+					(slot = fft_ring_peek(dev.ring)),
+					msecs_to_jiffies(READ_TIMEOUT_MS));
+			if (ret <= 0)
+				return taken ? taken : (ret ? ret : -EIO);
 		}
-		sample_struct->valid = ioread8(VALID(dev.virtbase)); 
-		iowrite8(0x0u, READING(dev.virtbase));
-		if (sample_struct->valid){
-			break;
+		if (copy_to_user(dst + taken, &slot->frame, sizeof(slot->frame)))
+			return -EFAULT;
+		fft_ring_release(dev.ring);
+		taken++;
+	}
+	return taken;
+}
+
+
+/*
+ * The ring has one reader, so frames are either taken through a file, with
+ * read() and the ioctls, or from the mapped ring, never both. A file that
+ * takes a frame becomes a reader for as long as it is open, unless the
+ * ring is mapped. Returns 0, or -EBUSY if the ring is mapped.
+ */
+static int fft_accelerator_claim(struct file *f)
+{
+	int ret = 0;
+
+	mutex_lock(&dev.open_lock);
+	if (!f->private_data) {
+		if (dev.mappings) {
+			ret = -EBUSY;
 		} else {
-			tries++;
+			f->private_data = &dev;
+			dev.fd_readers++;
 		}
 	}
-	printk("\tSample time delta: %d\n", sample_struct->time - prev_time);
-	prev_time = sample_struct->time;
+	mutex_unlock(&dev.open_lock);
+	return ret;
+}
+
+
+/*
+ * Fills a batch of frames for FFT_ACCELERATOR_READ_FFTS, with nothing
+ * allocated or logged.
+ */
+static long fft_accelerator_read_batch(fft_accelerator_batch_t __user *arg)
+{
+	fft_accelerator_batch_t batch;
+	uint32_t missed;
+	long ret;
+
+	if (copy_from_user(&batch, arg, sizeof(batch)))
+		return -EACCES;
+
+	if (mutex_lock_interruptible(&dev.lock))
+		return -ERESTARTSYS;
+	if (batch.flags & FFT_ACCELERATOR_RESTART) {
+		dev.missed_seen = fft_ring_load(&dev.ring->missed);
+		fft_ring_restart(dev.ring);
+	}
+	ret = batch.count ? fft_accelerator_take(batch.frames, batch.count, 1, 0) : 0;
+	missed = fft_ring_load(&dev.ring->missed);
+	batch.missed = missed - dev.missed_seen;
+	dev.missed_seen = missed;
+	mutex_unlock(&dev.lock);
+
+	if (ret < 0)
+		return ret;
+	batch.captured = ret;
+	if (copy_to_user(arg, &batch, sizeof(batch)))
+		return -EACCES;
 	return 0;
 }
 
 
 /*
  * Handle ioctl() calls from userspace:
- * Read or write the segments on single digits.
- * Note extensive error checking of arguments
- *
- * 
+ * FFT_ACCELERATOR_READ_FFT reads the next frame,
+ * FFT_ACCELERATOR_READ_FFTS the next batch of them.
  */
 static long fft_accelerator_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 {
-	fft_accelerator_fft_t *sample;
-	fft_accelerator_fft_t *dest;
 	fft_accelerator_arg_t arg_k;
+	long ret;
 
-	if (copy_from_user(&arg_k, (fft_accelerator_arg_t *) arg, sizeof(fft_accelerator_arg_t)))
-		return -EACCES;
+	if (cmd == FFT_ACCELERATOR_READ_FFT || cmd == FFT_ACCELERATOR_READ_FFTS) {
+		ret = fft_accelerator_claim(f);
+		if (ret)
+			return ret;
+	}
 
 	switch (cmd) {
 
 	case FFT_ACCELERATOR_READ_FFT:
-		sample = kmalloc(sizeof(fft_accelerator_fft_t), GFP_KERNEL);
-		if (sample == NULL) {
-			printk("nomem");
-			return -ENOMEM;
-		}
-		printk("About to read sample\n");
-		if (fft_accelerator_read_sample(sample) == -1) {
-			kfree(sample);			
-			return -EIO;
-		}
-		printk("Read Peaks\n");
-		dest = arg_k.fft_struct;
-		if (copy_to_user(dest, sample,
-				 sizeof(fft_accelerator_fft_t))) {
-			kfree(sample);			
+		if (copy_from_user(&arg_k, (fft_accelerator_arg_t *) arg, sizeof(fft_accelerator_arg_t)))
 			return -EACCES;
-		}
-		kfree(sample);
-		break;
+		if (mutex_lock_interruptible(&dev.lock))
+			return -ERESTARTSYS;
+		ret = fft_accelerator_take(arg_k.fft_struct, 1, 1, 0);
+		mutex_unlock(&dev.lock);
+		return ret < 0 ? ret : 0;
+
+	case FFT_ACCELERATOR_READ_FFTS:
+		return fft_accelerator_read_batch((fft_accelerator_batch_t __user *) arg);
 
 	default:
 		return -EINVAL;
 	}
+}
 
+/*
+ * read() gives whole frames, as many as are queued and fit, sleeping
+ * until there is one unless the file is O_NONBLOCK.
+ */
+static ssize_t fft_accelerator_read(struct file *f, char __user *buf,
+				    size_t len, loff_t *offset)
+{
+	uint32_t count = min_t(size_t, len / sizeof(fft_accelerator_fft_t),
+			       FFT_RING_SLOTS);
+	long ret;
+
+	if (!count)
+		return -EINVAL;
+	ret = fft_accelerator_claim(f);
+	if (ret)
+		return ret;
+	if (mutex_lock_interruptible(&dev.lock))
+		return -ERESTARTSYS;
+	ret = fft_accelerator_take((fft_accelerator_fft_t __user *) buf, count, 0,
+				   f->f_flags & O_NONBLOCK);
+	mutex_unlock(&dev.lock);
+	return ret < 0 ? ret : ret * sizeof(fft_accelerator_fft_t);
+}
+
+/*
+ * Readable whenever a frame is published and not taken, by read() or by a
+ * reader of the mapped ring, which sleeps here
+ */
+static unsigned int fft_accelerator_poll(struct file *f, poll_table *wait)
+{
+	poll_wait(f, &dev.wait, wait);
+	return fft_ring_peek(dev.ring) ? POLLIN | POLLRDNORM : 0;
+}
+
+/* Counts the mappings of the ring, copied on fork() or split */
+static void fft_accelerator_vm_open(struct vm_area_struct *vma)
+{
+	mutex_lock(&dev.open_lock);
+	dev.mappings++;
+	mutex_unlock(&dev.open_lock);
+}
+
+static void fft_accelerator_vm_close(struct vm_area_struct *vma)
+{
+	mutex_lock(&dev.open_lock);
+	dev.mappings--;
+	mutex_unlock(&dev.open_lock);
+}
+
+static const struct vm_operations_struct fft_accelerator_vm_ops = {
+	.open		= fft_accelerator_vm_open,
+	.close		= fft_accelerator_vm_close,
+};
+
+/*
+ * Maps the ring, which the reader then takes frames from in place. The
+ * mapping must be writable, for the reader to move tail. Fails with
+ * -EBUSY while a file takes frames with read() or the ioctls.
+ */
+static int fft_accelerator_mmap(struct file *f, struct vm_area_struct *vma)
+{
+	int ret = -EBUSY;
+
+	mutex_lock(&dev.open_lock);
+	if (!dev.fd_readers) {
+		ret = remap_vmalloc_range(vma, dev.ring, vma->vm_pgoff);
+		if (!ret) {
+			vma->vm_ops = &fft_accelerator_vm_ops;
+			dev.mappings++;
+		}
+	}
+	mutex_unlock(&dev.open_lock);
+	return ret;
+}
+
+/*
+ * The first open starts the producer with an empty ring. misc_open() leaves
+ * the miscdevice in private_data, which here marks a file as a reader
+ * instead, so it starts out NULL.
+ */
+static int fft_accelerator_open(struct inode *inode, struct file *f)
+{
+	f->private_data = NULL;
+	mutex_lock(&dev.open_lock);
+	if (dev.users++ == 0) {
+		dev.reader.primed = 0;
+		fft_ring_restart(dev.ring);
+		dev.missed_seen = dev.ring->missed;
+		hrtimer_start(&dev.timer, ns_to_ktime(FFT_TICK_NS),
+			      HRTIMER_MODE_REL_SOFT);
+	}
+	mutex_unlock(&dev.open_lock);
+	return 0;
+}
+
+/* The last close stops it */
+static int fft_accelerator_release(struct inode *inode, struct file *f)
+{
+	mutex_lock(&dev.open_lock);
+	if (f->private_data)
+		dev.fd_readers--;
+	if (--dev.users == 0)
+		hrtimer_cancel(&dev.timer);
+	mutex_unlock(&dev.open_lock);
 	return 0;
 }
 
 /* The operations our device knows how to do */
 static const struct file_operations fft_accelerator_fops = {
 	.owner		= THIS_MODULE,
+	.open		= fft_accelerator_open,
+	.release	= fft_accelerator_release,
+	.read		= fft_accelerator_read,
+	.poll		= fft_accelerator_poll,
+	.mmap		= fft_accelerator_mmap,
 	.unlocked_ioctl = fft_accelerator_ioctl,
 };
 
@@ -155,21 +347,30 @@ static int __init fft_accelerator_probe(struct platform_device *pdev)
 {
 	int ret;
 
-	/* Register ourselves as a misc device: creates /dev/fft_accelerator */
-	ret = misc_register(&fft_accelerator_misc_device);
+	mutex_init(&dev.lock);
+	mutex_init(&dev.open_lock);
+	init_waitqueue_head(&dev.wait);
+	hrtimer_init(&dev.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	dev.timer.function = fft_accelerator_tick;
+
+	/* Zeroed, and ready to be mapped into userspace */
+	dev.ring = vmalloc_user(sizeof(*dev.ring));
+	if (dev.ring == NULL)
+		return -ENOMEM;
+	fft_ring_init(dev.ring, 0);
 
 	/* Get the address of our registers from the device tree */
 	ret = of_address_to_resource(pdev->dev.of_node, 0, &dev.res);
 	if (ret) {
 		ret = -ENOENT;
-		goto out_deregister;
+		goto out_free_ring;
 	}
 
 	/* Make sure we can use these registers */
 	if (request_mem_region(dev.res.start, resource_size(&dev.res),
 			       DRIVER_NAME) == NULL) {
 		ret = -EBUSY;
-		goto out_deregister;
+		goto out_free_ring;
 	}
 
 	/* Arrange access to our registers */
@@ -178,22 +379,33 @@ static int __init fft_accelerator_probe(struct platform_device *pdev)
 		ret = -ENOMEM;
 		goto out_release_mem_region;
 	}
-        
+
+	/*
+	 * Register ourselves as a misc device: creates /dev/fft_accelerator,
+	 * which can be opened straight away, so everything it uses is ready
+	 */
+	ret = misc_register(&fft_accelerator_misc_device);
+	if (ret)
+		goto out_unmap;
+
 	return 0;
 
+out_unmap:
+	iounmap(dev.virtbase);
 out_release_mem_region:
 	release_mem_region(dev.res.start, resource_size(&dev.res));
-out_deregister:
-	misc_deregister(&fft_accelerator_misc_device);
+out_free_ring:
+	vfree(dev.ring);
 	return ret;
 }
 
 /* Clean-up code: release resources */
 static int fft_accelerator_remove(struct platform_device *pdev)
 {
+	misc_deregister(&fft_accelerator_misc_device);
 	iounmap(dev.virtbase);
 	release_mem_region(dev.res.start, resource_size(&dev.res));
-	misc_deregister(&fft_accelerator_misc_device);
+	vfree(dev.ring);
 	return 0;
 }
 
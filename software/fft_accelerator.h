@@ -31,9 +31,43 @@ typedef struct {
   fft_accelerator_fft_t *fft_struct;
 } fft_accelerator_arg_t;
 
+/* Consecutive frames, read by one FFT_ACCELERATOR_READ_FFTS */
+typedef struct {
+	fft_accelerator_fft_t *frames;	/* count frames, filled in order */
+	uint32_t count;		/* frames wanted */
+	uint32_t flags;		/* FFT_ACCELERATOR_RESTART */
+	uint32_t captured;	/* out: frames filled */
+	uint32_t missed;	/* out: frames made between them and not read */
+} fft_accelerator_batch_t;
+
+/* Starts a new capture: the frames made before its first aren't missed */
+#define FFT_ACCELERATOR_RESTART 0x1u
+
+#define FFT_RING_SLOTS 128	/* a power of 2, 683 ms of frames */
+
+/* A frame in the ring, and its number there plus one once published */
+typedef struct {
+	uint32_t seq;
+	fft_accelerator_fft_t frame;
+} fft_accelerator_slot_t;
+
+/*
+ * The ring of frames the driver fills, which a reader maps read and write
+ * with mmap() at offset 0 to take them in place. The driver writes head,
+ * missed and the slots, the reader tail. See fft_accelerator_ring.h.
+ */
+typedef struct {
+	uint32_t head;		/* frames published */
+	uint32_t tail;		/* frames taken */
+	uint32_t missed;	/* frames made and never published */
+	uint32_t slots;		/* FFT_RING_SLOTS */
+	fft_accelerator_slot_t slot[FFT_RING_SLOTS];
+} fft_accelerator_ring_t;
+
 #define FFT_ACCELERATOR_MAGIC 'p'
 
 /* ioctls and their arguments */
 #define FFT_ACCELERATOR_READ_FFT  _IOR(FFT_ACCELERATOR_MAGIC, 2, fft_accelerator_arg_t *)
+#define FFT_ACCELERATOR_READ_FFTS _IOWR(FFT_ACCELERATOR_MAGIC, 3, fft_accelerator_batch_t)
 
 #endif
@@ -0,0 +1,114 @@
+/*
+ * Register map, frame read path and producer of the FFT accelerator,
+ * shared by the driver and its userspace test.
+ *
+ * The read path only touches the device through three accessors, which
+ * the includer defines first:
+ *
+ *   fft_read32(addr)        32 bit register read
+ *   fft_read8(addr)         8 bit register read
+ *   fft_write8(val, addr)   8 bit register write
+ *
+ * The driver maps them to ioread32(), ioread8() and iowrite8();
+ * test_fft_accelerator to a simulated register block.
+ * Registers are addressed in bytes from base.
+ */
+
+#ifndef _FFT_ACCELERATOR_REGS_H
+#define _FFT_ACCELERATOR_REGS_H
+
+#include "fft_accelerator_ring.h"
+
+/* Device registers */
+#define AMPLITUDES(x)    (x)
+#define TIME_COUNT(x)    (AMPLITUDES(x) + AMPLITUDES_SIZE)
+#define VALID(x)         (TIME_COUNT(x) + COUNTER_WIDTH_BYES)
+#define READING(x)       (VALID(x) + 1)
+#define REGISTERS_SIZE   (READING(0) + 1)
+
+/*
+ * Reads of a torn frame in one tick before leaving it to the next. A frame
+ * tears when the next one lands mid read, which then stays put for a frame
+ * period, so one retry gets it and a tick reads at most two frames.
+ */
+#define FFT_READ_TRIES 2
+
+/* Nanoseconds between producer ticks, half a frame period */
+#define FFT_TICK_NS (500000000ull * DOWN_SAMPLING_FACTOR / SAMPLING_FREQ)
+
+/* What the read path keeps between frames */
+struct fft_accelerator_reader {
+	uint32_t prev_time;	/* TIME_COUNT of the last frame read */
+	int primed;		/* prev_time is from the current capture */
+};
+
+/*
+ * Reads the frame in the registers into out if it is newer than the last
+ * one read. The device sets VALID only if no new frame overwrote the
+ * amplitudes while READING was set, so a torn frame is read again.
+ * Returns 1 if there was a new frame, 0 if not, and -1 if new frames kept
+ * tearing it for FFT_READ_TRIES reads.
+ */
+static inline int fft_accelerator_poll_frame(uint8_t __iomem *base,
+	const struct fft_accelerator_reader *r, fft_accelerator_fft_t *out)
+{
+	int tries;
+	int i;
+
+	for (tries = 0; tries < FFT_READ_TRIES; tries++) {
+		out->time = fft_read32(TIME_COUNT(base));
+		if (r->primed && out->time == r->prev_time)
+			return 0;
+		fft_write8(0x1u, READING(base));
+		for (i = 0; i < N_FREQUENCIES; i++)
+			out->fft[i] = fft_read32(AMPLITUDES(base) + i*AMPL_WIDTH_BYTES);
+		out->valid = fft_read8(VALID(base));
+		fft_write8(0x0u, READING(base));
+		if (out->valid)
+			return 1;
+	}
+	return -1;
+}
+
+/*
+ * Takes frame as the last one read, adding the frames the device made
+ * since the one before that weren't read to *missed.
+ */
+static inline void fft_accelerator_account(struct fft_accelerator_reader *r,
+	const fft_accelerator_fft_t *frame, uint32_t *missed)
+{
+	/* the counter is 32 bit, so this is right across its wrap */
+	if (r->primed)
+		*missed += frame->time - r->prev_time - 1;
+	r->prev_time = frame->time;
+	r->primed = 1;
+}
+
+/*
+ * One producer tick, which runs twice per frame period so it sees every
+ * frame the device makes: reads a new frame straight into the ring's next
+ * slot and publishes it, or into spare to account for it if the ring is
+ * full. Returns 1 if it published a frame, else 0.
+ */
+static inline int fft_accelerator_produce(uint8_t __iomem *base,
+	struct fft_accelerator_reader *r, fft_accelerator_ring_t *ring,
+	fft_accelerator_fft_t *spare)
+{
+	fft_accelerator_slot_t *slot = fft_ring_next(ring);
+	fft_accelerator_fft_t *frame = slot ? &slot->frame : spare;
+	uint32_t missed = 0;
+
+	if (fft_accelerator_poll_frame(base, r, frame) != 1)
+		return 0;
+	fft_accelerator_account(r, frame, &missed);
+	if (!slot)
+		missed++;
+	if (missed)
+		fft_ring_store(&ring->missed, ring->missed + missed);
+	if (!slot)
+		return 0;
+	fft_ring_publish(ring);
+	return 1;
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Both ends of the frame ring (fft_accelerator_ring_t), shared by the
+ * driver, which fills it, and by readers, in the kernel for read() and the
+ * ioctls or in userspace through mmap().
+ *
+ * There is one producer and one reader, so the ring needs no lock. The
+ * producer writes a frame into the slot after head, then its seq, then
+ * head; a reader takes the frame at tail once that slot's seq says it has
+ * been published, then moves tail on to give the slot back. The seq of
+ * frame n is n + 1, so a slot still holding a frame from an earlier lap,
+ * or never written, is never taken for a new one. head never goes back,
+ * so neither does seq; a restart moves tail up to head instead.
+ *
+ * A full ring keeps its frames for the reader, and the producer counts the
+ * new ones as missed.
+ */
+
+#ifndef _FFT_ACCELERATOR_RING_H
+#define _FFT_ACCELERATOR_RING_H
+
+#include "fft_accelerator.h"
+
+#ifdef __KERNEL__
+#define fft_ring_load(p)      smp_load_acquire(p)
+#define fft_ring_store(p, v)  smp_store_release(p, v)
+#else
+#define fft_ring_load(p)      __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define fft_ring_store(p, v)  __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#endif
+
+/* Empties the ring, numbering its next frame head */
+static inline void fft_ring_init(fft_accelerator_ring_t *r, uint32_t head)
+{
+	uint32_t i;
+
+	/* seq i is never n + 1 for a frame n that could land in slot i */
+	for (i = 0; i < FFT_RING_SLOTS; i++)
+		r->slot[i].seq = i;
+	r->head = head;
+	r->tail = head;
+	r->missed = 0;
+	r->slots = FFT_RING_SLOTS;
+}
+
+/* Producer: the slot for the next frame, or NULL if the ring is full */
+static inline fft_accelerator_slot_t *fft_ring_next(fft_accelerator_ring_t *r)
+{
+	/* a reader may write anything to tail; that only makes the ring full */
+	if (r->head - fft_ring_load(&r->tail) >= FFT_RING_SLOTS)
+		return NULL;
+	return &r->slot[r->head % FFT_RING_SLOTS];
+}
+
+/* Producer: hands the frame written to fft_ring_next()'s slot to the reader */
+static inline void fft_ring_publish(fft_accelerator_ring_t *r)
+{
+	uint32_t head = r->head;
+
+	fft_ring_store(&r->slot[head % FFT_RING_SLOTS].seq, head + 1);
+	fft_ring_store(&r->head, head + 1);
+}
+
+/* Reader: the oldest frame not taken, or NULL if none is published */
+static inline fft_accelerator_slot_t *fft_ring_peek(fft_accelerator_ring_t *r)
+{
+	fft_accelerator_slot_t *slot = &r->slot[r->tail % FFT_RING_SLOTS];
+
+	return fft_ring_load(&slot->seq) == r->tail + 1 ? slot : NULL;
+}
+
+/* Reader: done with fft_ring_peek()'s frame, which the producer may reuse */
+static inline void fft_ring_release(fft_accelerator_ring_t *r)
+{
+	fft_ring_store(&r->tail, r->tail + 1);
+}
+
+/* Reader: drops the frames published so far, to start a new capture */
+static inline void fft_ring_restart(fft_accelerator_ring_t *r)
+{
+	fft_ring_store(&r->tail, fft_ring_load(&r->head));
+}
+
+#endif
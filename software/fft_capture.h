@@ -0,0 +1,186 @@
+/*
+ * Userspace end of the accelerator's frames. Maps the driver's ring
+ * (fft_accelerator_ring.h) and hands out its frames in place, sleeping in
+ * poll() when it is empty, so a frame is never copied on its way from the
+ * device. With a driver that can't be mapped, reads them with
+ * FFT_ACCELERATOR_READ_FFTS, FFT_CAPTURE_BATCH at a time.
+ *
+ * Either way it follows the device's time counter from frame to frame, so
+ * frames lost before one it hands out show as a gap there.
+ */
+
+#ifndef _FFT_CAPTURE_H
+#define _FFT_CAPTURE_H
+
+#include <cstdio>
+#include <cstdint>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "fft_accelerator_ring.h"
+
+#ifndef FFT_CAPTURE_BATCH
+#define FFT_CAPTURE_BATCH 16	/* frames per ioctl, 85 ms of audio */
+#endif
+
+/* A device that makes no frame for this long has stopped */
+#define FFT_CAPTURE_TIMEOUT_MS 100
+
+class fft_capture {
+public:
+	fft_capture() : next(0), size(0), missed_frames(0), restarting(true),
+		ring(NULL), mapped_fd(-1), holding(false), missed_base(0),
+		prev_time(0), timed(false), last_gap(0), gap_count(0), lost_frames(0) {}
+
+	~fft_capture()
+	{
+		if (ring)
+			munmap(ring, sizeof(*ring));
+	}
+
+	/*
+	 * Starts a new recording: frames still buffered from before are
+	 * dropped, and those the device made meanwhile aren't missed.
+	 */
+	void restart()
+	{
+		next = 0;
+		size = 0;
+		missed_frames = 0;
+		restarting = true;
+		timed = false;
+		last_gap = 0;
+		gap_count = 0;
+		lost_frames = 0;
+	}
+
+	/*
+	 * The next frame from fd, or NULL if the device failed. It stays valid
+	 * until the next call.
+	 */
+	const fft_accelerator_fft_t * read(int fd)
+	{
+		if (fd != mapped_fd)
+			map(fd);
+		return follow(ring ? take(fd) : read_batch(fd));
+	}
+
+	/* Frames the device made since restart() that weren't read */
+	uint64_t missed() const
+	{
+		if (ring && !restarting)
+			return (uint32_t) (fft_ring_load(&ring->missed) - missed_base);
+		return missed_frames;
+	}
+
+	/* Frames lost just before the one read() handed out last */
+	uint32_t gap() const { return last_gap; }
+
+	/* Gaps since restart(), and the frames lost in them */
+	uint64_t gaps() const { return gap_count; }
+	uint64_t lost() const { return lost_frames; }
+
+private:
+	/* The next frame of a batch read with the ioctl */
+	const fft_accelerator_fft_t * read_batch(int fd)
+	{
+		if (next == size) {
+			fft_accelerator_batch_t batch;
+			batch.frames = frames;
+			batch.count = FFT_CAPTURE_BATCH;
+			batch.flags = restarting ? FFT_ACCELERATOR_RESTART : 0;
+			if (ioctl(fd, FFT_ACCELERATOR_READ_FFTS, &batch)) {
+				perror("ioctl(FFT_ACCELERATOR_READ_FFTS) failed");
+				return NULL;
+			}
+			restarting = false;
+			next = 0;
+			size = batch.captured;
+			missed_frames += batch.missed;
+		}
+		return &frames[next++];
+	}
+
+	/*
+	 * Notes the gap before frame, if any. A counter that went back means
+	 * the device started over, not that frames were lost.
+	 */
+	const fft_accelerator_fft_t * follow(const fft_accelerator_fft_t * frame)
+	{
+		if (!frame)
+			return NULL;
+		int32_t step = frame->time - prev_time;
+		last_gap = timed && step > 1 ? step - 1 : 0;
+		if (last_gap) {
+			gap_count++;
+			lost_frames += last_gap;
+		}
+		prev_time = frame->time;
+		timed = true;
+		return frame;
+	}
+
+	/* Maps fd's ring, leaving ring NULL if the driver has none */
+	void map(int fd)
+	{
+		if (ring)
+			munmap(ring, sizeof(*ring));
+		void * p = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+		ring = p == MAP_FAILED ? NULL : (fft_accelerator_ring_t *) p;
+		if (ring && ring->slots != FFT_RING_SLOTS) {
+			munmap(ring, sizeof(*ring));
+			ring = NULL;
+		}
+		mapped_fd = fd;
+		holding = false;
+	}
+
+	/* The next frame in the ring, giving back the one handed out last */
+	const fft_accelerator_fft_t * take(int fd)
+	{
+		fft_accelerator_slot_t * slot;
+
+		if (holding)
+			fft_ring_release(ring);
+		holding = false;
+		if (restarting) {
+			missed_base = fft_ring_load(&ring->missed);
+			fft_ring_restart(ring);
+			restarting = false;
+		}
+		while (!(slot = fft_ring_peek(ring))) {
+			struct pollfd pfd = { fd, POLLIN, 0 };
+			int ready = poll(&pfd, 1, FFT_CAPTURE_TIMEOUT_MS);
+			if (ready < 0) {
+				perror("poll() on the accelerator failed");
+				return NULL;
+			}
+			if (!ready) {
+				fprintf(stderr, "The accelerator made no frame\n");
+				return NULL;
+			}
+		}
+		holding = true;
+		return &slot->frame;
+	}
+
+	fft_accelerator_fft_t frames[FFT_CAPTURE_BATCH];
+	uint32_t next;
+	uint32_t size;
+	uint64_t missed_frames;
+	bool restarting;
+
+	fft_accelerator_ring_t * ring;	/* mapped, or NULL to use the ioctl */
+	int mapped_fd;
+	bool holding;		/* the frame at ring->tail is handed out */
+	uint32_t missed_base;	/* ring->missed at restart() */
+
+	uint32_t prev_time;	/* of the last frame handed out */
+	bool timed;		/* since restart() */
+	uint32_t last_gap;
+	uint64_t gap_count;
+	uint64_t lost_frames;
+};
+
+#endif
@@ -13,6 +13,7 @@
 #include <algorithm>
 #include <cfloat>
 #include <cmath>
+#include <chrono>
 #include "fft_accelerator.h"
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -35,86 +36,42 @@
 #define STD_DEV_COEF 1.25
 #define T_ZONE 4
 
-struct peak_raw {
-	float ampl;
-	uint16_t freq;
-	uint16_t time;
-};
-
-struct peak {
-	uint16_t freq;
-	uint16_t time;
-};
-
-struct fingerprint {
-	uint16_t anchor;
-	uint16_t point;
-	uint16_t delta;
-};
-
-struct song_data {
-	std::string song_name;
-	uint16_t time_pt;
-	uint16_t song_ID;
-};
-
-struct hash_pair {
-	uint64_t fingerprint;
-	struct song_data value;
-};
-
-struct count_ID {
-	std::string song;
-	int count;
-	int num_hashes;
-};
-
-struct database_info{
-	std::string song_name;
-	uint16_t song_ID;
-	int hash_count;
-};
-
-std::list<hash_pair> hash_create(std::string song_name, uint16_t song_ID);
-
-std::list<hash_pair> generate_fingerprints(std::list<peak> pruned, 
-	std::string song_name, uint16_t song_ID);
+#define LIVE_WINDOW_SEC 10	/* audio each live identification votes on */
+#define LIVE_REPORT_SEC 3	/* time between live identifications */
 
-std::unordered_map<uint16_t, count_ID> identify_sample(
-	const std::list<hash_pair> & sample_prints, 
-	const std::unordered_multimap<uint64_t, song_data> & database,
-	std::list<database_info> song_list);
+#include "shazam.h"
+#include "spectrogram.h"
+#include "constellation.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+#include "query_context.h"
+#include "frame_fingerprinter.h"
+#include "sliding_voter.h"
+#include "capture_thread.h"
 
-std::list<peak> generate_constellation_map(std::vector<std::vector<float>> fft, int nfft);
+std::vector<fingerprint_record> hash_create(std::string song_name, uint16_t song_ID);
 
-std::list<peak> read_constellation(std::string filename);
+void identify_progressive(query_context & query, const fingerprint_index & db,
+	float sec);
 
-std::vector<std::vector<float>> get_fft_from_audio(float sec);
-
-std::list<hash_pair> hash_create_from_audio(float sec);
-
-float score(const struct count_ID &c) {
-	return ((float) c.count)/std::pow(c.num_hashes, NORM_POW);	
-}
+void identify_live(const fingerprint_index & db, const std::list<database_info> & songs);
 
-bool sortByScore(const struct count_ID &lhs, const struct count_ID &rhs) { 
-	return lhs.count == rhs.count ? score(lhs) > score(rhs) : lhs.count > rhs.count;
-}
+void report_capture();
 
 int fft_accelerator_fd;
+capture_thread capture;
 
-int main()
+int main(int argc, char ** argv)
 {
 	/*
 	 * Assumes fft spectrogram files are availible at ./song_name, and that
 	 * song_list.txt exists and contains a list of the song names.
+	 *
+	 * recognize_board live identifies continuously instead of on ENTER.
 	 */
 	
-	std::unordered_multimap<uint64_t, song_data> db;
+	fingerprint_index db;
 	std::list<database_info> song_names;
-	std::unordered_map<uint16_t, count_ID> results;
-	struct hash_pair pair;
-	std::pair<uint64_t, song_data> temp_db;
 	struct database_info temp_db_info;
 	std::string temp_match;
 	std::string temp_s;
@@ -135,455 +92,228 @@ int main()
 		return -1;
 	}
 	
-	file.open("song_list.txt");
-	while(getline(file, line)){
-	   if(!line.empty()){
-
-		num_db++;
-		temp_s = "./"+ line;
-		hash_count = 0;
+	/* fingerprints.boardpeak.db is written by build_db */
+	std::string db_file = fingerprint_db_name(".boardpeak");
+	if (db.load(db_file, &song_names)) {
+		for (auto it = song_names.begin(); it != song_names.end(); ++it)
+			it->song_name = "./" + it->song_name;
+		std::cout << "Loaded " << song_names.size() << " songs from "
+			<< db_file << std::endl;
+	} else {
+		file.open("song_list.txt");
+		while(getline(file, line)){
+		   if(!line.empty()){
+
+			num_db++;
+			temp_s = "./"+ line;
+			hash_count = 0;
 			
-		std::list<hash_pair> temp;
-		temp = hash_create(temp_s, num_db);
+			std::vector<fingerprint_record> temp;
+			temp = hash_create(temp_s, num_db);
 		
-		for(std::list<hash_pair>::iterator it = temp.begin(); 
-			  it != temp.end(); ++it){	
-
-			temp_db.first = it->fingerprint;
-		       	temp_db.second = it->value;
-			db.insert(temp_db);
-			
-			hash_count++;	
-		}	
+			db.add(temp, num_db);
+			hash_count = temp.size();
 		
-		temp_db_info.song_name = temp_s;
-		temp_db_info.hash_count = hash_count;
-		temp_db_info.song_ID = num_db;
-		song_names.push_back(temp_db_info);
+			temp_db_info.song_name = temp_s;
+			temp_db_info.hash_count = hash_count;
+			temp_db_info.song_ID = num_db;
+			song_names.push_back(temp_db_info);
 	   	
-		std::cout <<  "(" << num_db << ") ";
-		std::cout << temp_s;
-		std::cout << " databased.\n Number of hash table entries: ";
-		std::cout << temp.size() << std::endl;
-	     	std::cout << std::endl;
-	     	std::cout << std::endl;
-	   }
+			std::cout <<  "(" << num_db << ") ";
+			std::cout << temp_s;
+			std::cout << " databased.\n Number of hash table entries: ";
+			std::cout << temp.size() << std::endl;
+		     	std::cout << std::endl;
+		     	std::cout << std::endl;
+		   }
+		}
+		file.close();
+		db.build();
 	}
-	file.close();
 
 	/*DEBUG*/
 	std::cout << "Full database completed \n\n" << std::endl;
 
+	if (argc > 1 && std::string(argv[1]) == "live") {
+		identify_live(db, song_names);
+		return 0;
+	}
+
+	/* everything identifying needs, made once for all samples */
+	query_context query(song_names);
+
 	
 	while(true)
 	{
 		std::cout << "Ready to identify. Press ENTER to identify the song playing.\n";
 		std::cin.ignore();
 
-		temp_s = line; 
-		std::list<hash_pair> identify;
-		// identify = hash_create_noise(temp_s, num_db);
-		identify = hash_create_from_audio(30);
-		std::cout << "Done listening.\n"; 
-		
-
-		results = identify_sample(identify, db, song_names);
-
-		std::vector<count_ID> sorted_results;
-		for(auto iter = results.begin(); 
-			iter != results.end(); ++iter){	
-			sorted_results.push_back(iter->second);
-		}
-		std::sort(sorted_results.begin(), sorted_results.end(), sortByScore);
-		for (auto c = sorted_results.cbegin(); c != sorted_results.cend(); c++) {
-		    std::cout << "-" << c->song << " /" << score(*c) << "/" << c->count << std::endl;
-		}
-
+		identify_progressive(query, db, 30);
 	}
 	
 	return 0;
 }
 
 
-std::unordered_map<uint16_t, count_ID> identify_sample(
-	const std::list<hash_pair> & sample_prints, 
-	const std::unordered_multimap<uint64_t, song_data> & database,
-	std::list<database_info> song_list)
-{
-	std::cout << "call to identify" << std::endl;
-	
-	std::unordered_map<uint16_t, count_ID> results;
-	//new database, keys are songIDs concatenated with time anchor
-	//values are number of appearances, if 5 we've matched
-	std::unordered_map<uint64_t, uint8_t> db2;
-	uint64_t new_key;
-	uint16_t identity;
-
-	for(std::list<database_info>::iterator iter = song_list.begin(); 
-		iter != song_list.end(); ++iter){	
-		//scaling may no longer be necessary, but currently used
-		results[iter->song_ID].num_hashes = iter->hash_count;
-		results[iter->song_ID].song = iter->song_name;
-		//set count to zero, will now be number of target zones matched
-		results[iter->song_ID].count = 0;
-
-	}	
-
-	//for fingerpint in sampleFingerprints
-	for(auto iter = sample_prints.begin(); 
-		iter != sample_prints.end(); ++iter){	
-		
-	    // get all the entries at this hash location
-	    const auto & ret = database.equal_range(iter->fingerprint);
-
-	    //lets insert the song_ID, time anchor pairs in our new database
-	    for(auto  it = ret.first; it != ret.second; ++it){
-		  
-		    new_key = it->second.song_ID;
-		    new_key = new_key << 16;
-		    new_key |= it->second.time_pt;
-		    new_key = new_key << 16;
-		    new_key |= iter->value.time_pt;
-
-		    db2[new_key]++;
-	    }
-		
-	}
-	// second database is fully populated
-
-
-	//adds to their count in the results structure, which is returned
-	for(std::unordered_map<uint64_t,uint8_t>::iterator
-			    it = db2.begin(); it != db2.end(); ++it){
-		
-		//full target zone matched
-		if(it->second >= T_ZONE)
-		{
-			//std::cout << it->second << std::endl;
-			identity = it->first >> 32;
-			results[identity].count += (int) (it->second);
-		}
-	}    
-
-	return results;
-
-}
-
-std::list<hash_pair> hash_create(std::string song_name, uint16_t song_ID)
+std::vector<fingerprint_record> hash_create(std::string song_name, uint16_t song_ID)
 {	
 	std::cout << "call to hash_create" << std::endl;
 	std::cout << "Song ID = " << song_ID << std::endl; 
 
-	std::list<peak> pruned_peaks;
-	pruned_peaks = read_constellation(song_name);			
+	std::vector<peak> pruned_peaks;
+	if (!read_peak_file(song_name + ".boardpeak", pruned_peaks))
+		std::cerr << "could not read " << song_name << ".boardpeak" << std::endl;
 	
-	std::list<hash_pair> hash_entries;
-	hash_entries = generate_fingerprints(pruned_peaks, song_name, song_ID);
+	std::vector<fingerprint_record> hash_entries;
+	generate_fingerprints(pruned_peaks, hash_entries);
 
 	return hash_entries;
 }
 
-std::list<hash_pair> hash_create_from_audio(float sec)
-{	
-	uint16_t song_ID = 0;
-	std::string song_name = "AUDIO";
-	std::cout << "call to hash_create_from_audio" << std::endl;
-	std::vector<std::vector<float>> fft;
-	fft = get_fft_from_audio(sec);	
-
-	std::list<peak> pruned_peaks;
-	pruned_peaks = generate_constellation_map(fft, NFFT);
-
-	std::list<hash_pair> hash_entries;
-	hash_entries = generate_fingerprints(pruned_peaks, song_name, song_ID);
-
-	return hash_entries;
-}
-
-std::list<hash_pair> generate_fingerprints(std::list<peak> pruned, 
-	std::string song_name, uint16_t song_ID)
-{
-	std::list<hash_pair> fingerprints;
-	struct fingerprint f;
-	struct song_data sdata;
-	struct hash_pair entry;
-	uint16_t target_zone_t;
-	uint64_t template_print;
-	struct peak other_point;
-	struct peak anchor_point;
-
-	int target_offset = 2;
-
-	target_zone_t = T_ZONE;
-	
-
-	for(std::list<peak>::iterator it = pruned.begin(); 
-	 std::next(it, target_zone_t + target_offset) != pruned.end(); it++){
-
-		anchor_point= *it;
-	
-		for(uint16_t i = 1; i <= target_zone_t; i++){
-			
-			other_point = *(std::next(it, i + target_offset));
-			
-			f.anchor = anchor_point.freq;
-			f.point = other_point.freq;
-			f.delta	= other_point.time - anchor_point.time;
-			
-			sdata.song_name = song_name;
-			sdata.time_pt = anchor_point.time;
-			sdata.song_ID = song_ID;
-
-			template_print = f.anchor;
-			template_print = template_print << 16;
-			template_print |= f.point;
-			template_print = template_print << 16;
-			template_print |= f.delta;
-
-			entry.fingerprint = template_print;
-			entry.value = sdata;
-	
-			fingerprints.push_back(entry);
-		}
-	}	
-
-	return fingerprints;
-}
-
-
 uint32_t sec_to_samples(float sec) {
-	return (int) sec*(SAMPLING_FREQ/DOWN_SAMPLING_FACTOR); 
+	return (uint32_t) (sec * (SAMPLING_FREQ/DOWN_SAMPLING_FACTOR));
 }
 
 float samples_to_sec(uint32_t samples) {
 	return  ((float) samples)/SAMPLING_FREQ; 
 }
 
-float ampl2float(ampl_t fixed) {
-	// divide by 2^(fixed point accuracy) 2^7.
-	return ((float) fixed) / std::pow(2.0, AMPL_FRACTIONAL_BITS);
-}
-
-#define ERR_IO 0xFFFFFFFFFFFFFFFFu
-#define ERR_NVALID 0xFFFFFFFFFFFFFFFEu
-
-uint64_t get_sample(std::vector<float> & fft) {
-	fft_accelerator_arg_t vla;
-	fft_accelerator_fft_t fft_struct;
-	vla.fft_struct = &fft_struct;
-
-	fft.clear();
-	fft.reserve(N_FREQUENCIES);
-
-	if (ioctl(fft_accelerator_fd, FFT_ACCELERATOR_READ_FFT, &vla)) {
-		perror("ioctl(FFT_ACCELERATOR_READ_FFT) failed");
-		return ERR_IO;
-	}
-	if(!fft_struct.valid) {
-		return ERR_NVALID;
+/*
+ * Records up to sec seconds and identifies them while recording: the
+ * capture thread queues each frame as it arrives, and this one takes it,
+ * fingerprints it and votes its fingerprints straight away, so the answer
+ * comes as soon as the leader is ANSWER_CONFIDENCE ahead. If it never is,
+ * the whole recording is ranked as before. Either way the time to the
+ * answer is logged, with how the capture kept up.
+ */
+void identify_progressive(query_context & query, const fingerprint_index & db,
+	float sec)
+{
+	static frame_fingerprinter fingerprinter;
+	std::vector<fingerprint_record> prints;
+	std::vector<fingerprint_record> recording;
+	const captured_frame * frame;
+	auto start = std::chrono::steady_clock::now();
+
+	fingerprinter.reset();
+	query.begin();
+	capture.start(fft_accelerator_fd, sec_to_samples(sec));
+	while ((frame = capture.next())) {
+		fingerprinter.skip(frame->gap);
+		fingerprinter.push(frame->magnitude, prints);
+		capture.pop();
+		if (prints.empty())
+			continue;
+		recording.insert(recording.end(), prints.begin(), prints.end());
+
+		const top_result & top = query.add(prints, db);
+		if (top.answered()) {
+			std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+			std::cout << "-" << query.song(top.leaders[0].song_ID).song << " /"
+				<< top.leaders[0].votes << " votes, " << 100 * top.confidence
+				<< "% ahead, from " << frames_to_seconds(top.leaders[0].offset)
+				<< " s into the song" << std::endl;
+			capture.stop();
+			std::cout << "Time to answer: " << elapsed.count() << " s, after "
+				<< frames_to_seconds(fingerprinter.frame_count()) << " s of audio"
+				<< std::endl;
+			report_capture();
+			return;
+		}
 	}
-	for (int i = 0; i < N_FREQUENCIES; i++) {
-		//std::cout << ampl2float(fft_struct.fft[i]) << " ";
-		fft.push_back(ampl2float(fft_struct.fft[i]));
+	if (capture.failed())
+		std::cout << "Could not get audio fft\n";
+	fingerprinter.flush(prints);
+	recording.insert(recording.end(), prints.begin(), prints.end());
+	std::cout << "Done listening.\n";
+
+	const std::vector<const count_ID *> & ranked = query.identify(recording, db);
+	for (auto c = ranked.cbegin(); c != ranked.cend(); c++) {
+	    std::cout << "-" << (*c)->song << " /" << query_context::score(**c)
+		<< "/" << (*c)->count << " @" << frames_to_seconds((*c)->offset)
+		<< "s" << std::endl;
 	}
-		//std::cout << std::endl;
-	return fft_struct.time;
+	std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << "Time to answer: " << elapsed.count() << " s, no early answer in "
+		<< frames_to_seconds(fingerprinter.frame_count()) << " s of audio"
+		<< std::endl;
+	report_capture();
 }
 
 
-std::vector<std::vector<float>> get_fft_from_audio(float sec) {
-	uint32_t samples = sec_to_samples(sec);
-	std::cout << samples << std::endl;
-	std::vector<std::vector<float>> spec;
-	spec.reserve(N_FREQUENCIES);
-	for (int i = 0; i < N_FREQUENCIES; i++) {
-		std::vector<float> vec;
-		vec.reserve(samples);
-		spec.push_back(vec);
-	}
-	std::vector<float> fft_temp;
-	uint64_t time;
-
-	for (uint32_t i = 0; i < samples; i++) {
-		time = get_sample(fft_temp);
-		//this assumes we miss nothing
-	
-		for(uint32_t j = 0; j < N_FREQUENCIES; j++){
-			//std::cout << fft_temp[j] << " ";
-			spec[j].push_back(std::abs(fft_temp[j]));
-		}	
-			//std::cout << std::endl;
-		if (time == ERR_IO || time == ERR_NVALID) {
-			std::cout << "Could not get audio fft\n";
-		        // spec[0].size < samples
-			return spec;
-		}
-		 //copy contents of fft_temp into spec[i], averaging if there are missed times.
-
-	}
-	return spec;
+/* Prints how the capture thread is keeping up with the device */
+void report_capture()
+{
+	std::cout << "Capture: " << capture.queued() << " frames queued, at most "
+		<< capture.peak_queued() << " of " << CAPTURE_QUEUE_FRAMES << ", "
+		<< capture.missed() << " missed by the device, " << capture.dropped()
+		<< " dropped, " << capture.lost() << " lost in " << capture.gaps()
+		<< " gaps" << std::endl;
 }
 
-// Eitan's re-write:
-
-inline int freq_to_bin(uint16_t freq) {
-	if (freq <  BIN1) 
-		return 1;
-	if (freq <  BIN2) 
-		return 2;
-	if (freq <  BIN3) 
-		return 3;
-	if (freq <  BIN4) 
-		return 4;
-	if (freq <  BIN5) 
-		return 5;
-	if (freq <  BIN6) 
-		return 6;
-	return 0;
-}
 
-std::list<peak_raw> get_raw_peaks(std::vector<std::vector<float>> fft, int nfft)
+/*
+ * Identifies whatever is playing, for as long as audio comes: each frame
+ * the capture thread queues is fingerprinted as it arrives, the
+ * fingerprints are voted into a sliding_voter over the last
+ * LIVE_WINDOW_SEC seconds, and the leader is printed every LIVE_REPORT_SEC
+ * seconds, with how the capture is keeping up. Frames lost on the way move
+ * the window on, and after a gap too long for the fingerprinter to follow
+ * the window starts over.
+ */
+void identify_live(const fingerprint_index & db, const std::list<database_info> & songs)
 {
-    std::list<peak_raw> peaks;
-    uint16_t size_in_time;
-    
-    size_in_time = fft[0].size();
-    for(uint16_t j = 1; j < size_in_time-2; j++){
-	// WARNING not parametrized by NBINS
-	float max_ampl_by_bin[NBINS + 1] = {FLT_MIN, FLT_MIN, FLT_MIN, FLT_MIN, FLT_MIN, FLT_MIN, FLT_MIN};  
-    	struct peak_raw max_peak_by_bin[NBINS + 1] = {};
-        for(uint16_t i = 0; i < fft.size() - 1; i++){
-            if(     fft[i][j] > fft[i][j-1]                      && //west
-    	            fft[i][j] > fft[i][j+1]                      && //east
-    	            (i < 1           || fft[i][j] > fft[i-1][j]) && //north
-    	            (i >= fft.size() || fft[i][j] > fft[i+1][j])) { //south
-		if (fft[i][j] > max_ampl_by_bin[freq_to_bin(i)]) {
-		    max_ampl_by_bin[freq_to_bin(i)] = fft[i][j];
-		    max_peak_by_bin[freq_to_bin(i)].freq = i;
-		    max_peak_by_bin[freq_to_bin(i)].ampl = fft[i][j];
-		    max_peak_by_bin[freq_to_bin(i)].time = j;
-		}
-            }
-        }
-	for (int k = 1; k <= NBINS; k++) {
-	    if (max_peak_by_bin[k].time != 0) {
-                peaks.push_back(max_peak_by_bin[k]);
-	    }
+	sliding_voter live(sec_to_samples(LIVE_WINDOW_SEC));
+	frame_fingerprinter fingerprinter;
+	std::vector<std::string> names;		/* by song_ID */
+	std::vector<fingerprint_record> prints;
+	std::vector<offset_match> leaders;
+	const captured_frame * frame;
+	uint32_t report = sec_to_samples(LIVE_REPORT_SEC);
+
+	for (auto it = songs.cbegin(); it != songs.cend(); ++it) {
+		if (names.size() <= it->song_ID)
+			names.resize(it->song_ID + 1);
+		names[it->song_ID] = it->song_name;
 	}
-    }
-    return peaks;
-}
+	live.reserve(songs.size(), names.size() - 1);
 
-std::list<peak> prune_in_time(std::list<peak_raw> unpruned_peaks) {
-	int time = 0;
-	float num[NBINS + 1] = { };  
-	float den[NBINS + 1] = { };  
-	float dev[NBINS + 1] = { };
-	int bin;
-	unsigned int bin_counts[NBINS + 1] = { };  
-	unsigned int bin_prune_counts[NBINS + 1] = { };  
-	std::list<peak> pruned_peaks;
-	auto add_iter = unpruned_peaks.cbegin();
-	auto dev_iter = unpruned_peaks.cbegin();
-	for(auto avg_iter = unpruned_peaks.cbegin(); add_iter != unpruned_peaks.cend(); ){
-	
-		if (avg_iter->time <= time + PRUNING_TIME_WINDOW && avg_iter != unpruned_peaks.cend()) {
-			bin = freq_to_bin(avg_iter->freq);
-			den[bin]++;
-			num[bin] += avg_iter->ampl;
-			avg_iter++;
+	std::cout << "Listening. Identifying the last " << LIVE_WINDOW_SEC
+		<< " s every " << LIVE_REPORT_SEC << " s.\n";
+	capture.start(fft_accelerator_fd);
+	for (uint32_t t = 0; ; t++) {
+		if (!(frame = capture.next())) {
+			std::cout << "Could not get audio fft\n";
+			report_capture();
+			return;
+		}
+		uint32_t gap = frame->gap;
+		fingerprinter.skip(gap);
+		fingerprinter.push(frame->magnitude, prints);
+		capture.pop();
+		if (gap < frame_fingerprinter::LONG_GAP) {
+			live.skip(gap);
+			live.push(prints, db);
 		} else {
-
-			while(dev_iter != avg_iter){
-				if (dev_iter->time <= time + PRUNING_TIME_WINDOW 
-					&& dev_iter != unpruned_peaks.cend()) {
-				
-					bin = freq_to_bin(dev_iter->freq);
-					if(den[bin]){
-						dev[bin] += pow(dev_iter->ampl - num[bin]/den[bin], 2);
-					}
-					else{
-						dev[bin] = den[bin];
-					}
-				}
-				dev_iter++;	
-			}
-			for (int i = 1; i <= NBINS; i++)
-			{
-				if(den[i]){
-					dev[i] = sqrt(dev[i]/den[i]);
-				}
-				//std::cout << dev[i] << " ";
-			}
-			//std::cout << std::endl;
-			while (add_iter != avg_iter) {
-				bin = freq_to_bin(add_iter->freq);
-				if (den[bin] && add_iter->ampl > STD_DEV_COEF*dev[bin] + num[bin]/den[bin]  ) {
-					pruned_peaks.push_back({add_iter->freq, add_iter->time});
-					bin_counts[freq_to_bin(add_iter->freq)]++;
-				} else {
-					bin_prune_counts[freq_to_bin(add_iter->freq)]++;
-				}
-				add_iter++;
-			}
-			memset(num, 0, sizeof(num));
-			memset(den, 0, sizeof(den));
-			time += PRUNING_TIME_WINDOW;
+			/* what came out is from before the gap, too far back to order */
+			live.reset();
 		}
-	}
-	for (int i = 1; i <= NBINS; i++) {
-		std::cout << "bin " << i << ": " << bin_counts[i] << "|  pruned: " << bin_prune_counts[i] << std::endl;
-	}
-	return pruned_peaks;
-}
-				
-
-
-std::list<peak> generate_constellation_map(std::vector<std::vector<float>> fft, int nfft)
-{
-	std::list<peak_raw> unpruned_map;
-	unpruned_map = get_raw_peaks(fft, nfft);
-	return prune_in_time(unpruned_map);
-}
 
-std::list<peak> read_constellation(std::string filename){
-
-	std::ifstream fin;
-	std::list<peak> constellation;
-	uint32_t peak_32;
-	struct peak temp;
-	std::streampos size;
-  	char * memblock;
-	int i;
-	
-	fin.open(filename+".boardpeak", std::ios::binary | std::ios::in 
-			| std::ios::ate);
-
-	i = 0;
-      	if (fin.is_open())
-       	{
-	     size = fin.tellg(); 
-	     memblock = new char [size];
-	     
-	     fin.seekg (0, std::ios::beg);
-	     fin.read (memblock, size);
-	     fin.close();
-	     
-	     while(i < size)
-	     {
-
-		    peak_32 = *(uint32_t *)(memblock+i);
-		    temp.time = peak_32;
-		    temp.freq = peak_32 >> 16;
-		    constellation.push_back(temp);
-		    /* MUST incremet by this amount here*/
-		    i += sizeof(peak_32);
-	     }
-
-
-	     delete[] memblock;
+		if ((t + 1) % report)
+			continue;
+		report_capture();
+		live.leaders(2, leaders);
+		std::cout << "[" << (t + 1) / report * LIVE_REPORT_SEC << " s] ";
+		if (leaders.empty() || !leaders[0].votes) {
+			std::cout << "no match\n";
+			continue;
+		}
+		uint32_t runner_up = leaders.size() > 1 ? leaders[1].votes : 0;
+		/* offsets are of 16 bit frame times, so the position wraps with them */
+		uint32_t now = (leaders[0].offset + fingerprinter.frame_count() - 1) & 0xffff;
+		std::cout << names[leaders[0].song_ID] << " /" << leaders[0].votes
+			<< " votes, " << 100 * (leaders[0].votes - runner_up) / leaders[0].votes
+			<< "% ahead, now " << frames_to_seconds(now) << " s into it, "
+			<< live.fingerprints() << " fingerprints" << std::endl;
 	}
-
-	return constellation;
-
 }
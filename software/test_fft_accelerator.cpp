@@ -0,0 +1,684 @@
+/*
+ * Checks the driver's read path and producer (fft_accelerator_regs.h) and
+ * the frame ring (fft_accelerator_ring.h) against a simulated register
+ * block: frames made one by one, skipped, torn while being read, past the
+ * ring's size or across the time counter's wrap, then by a thread standing
+ * in for the FPGA while another runs the producer on a timer and a third
+ * takes them in place. Last, fft_capture reads a ring it maps, a
+ * capture_thread queues its frames for another thread, and a device
+ * dropping frames, a few at a time and once a long run, shows its gaps to
+ * the fingerprinter, which must keep its peaks' times true.
+ *
+ * Usage:
+ *   test_fft_accelerator
+ */
+
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <set>
+#include <utility>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define __iomem
+
+static uint32_t sim_read32(void * addr);
+static uint8_t sim_read8(void * addr);
+static void sim_write8(uint8_t val, void * addr);
+#define fft_read32(addr)       sim_read32(addr)
+#define fft_read8(addr)        sim_read8(addr)
+#define fft_write8(val, addr)  sim_write8(val, addr)
+#include "fft_accelerator_regs.h"
+#include "fft_capture.h"
+#include "capture_thread.h"
+#include "frame_fingerprinter.h"
+
+/* The simulated device; sim_lock stands for the bus */
+static struct {
+	uint8_t regs[REGISTERS_SIZE];
+	uint32_t time;		/* of the frame in regs */
+	bool tear;		/* makes a frame during the next read */
+	bool tear_all;		/* and during every read */
+	bool reading;
+} sim;
+static std::mutex sim_lock;
+
+/* Heavy tailed noise, like a spectrum, so frames have peaks that survive pruning */
+static int32_t amplitude(uint32_t time, int i)
+{
+	uint32_t h = time * 2654435761u ^ (uint32_t) i * 2246822519u;
+
+	h ^= h >> 15;
+	h *= 2246822519u;
+	h ^= h >> 13;
+	return (int32_t) (0x3FFFFFFFu / ((h >> 12) + 1));
+}
+
+/* Makes the next frame, spoiling the one being read if there is one */
+static void sim_frame()
+{
+	sim.time++;
+	for (int i = 0; i < N_FREQUENCIES; i++) {
+		int32_t a = amplitude(sim.time, i);
+		memcpy(&sim.regs[AMPLITUDES(0) + i*AMPL_WIDTH_BYTES], &a, 4);
+	}
+	memcpy(&sim.regs[TIME_COUNT(0)], &sim.time, 4);
+	if (sim.reading)
+		sim.regs[VALID(0)] = 0;
+}
+
+/* Makes frames until the one in the registers is time */
+static void sim_reset(uint32_t time)
+{
+	std::lock_guard<std::mutex> bus(sim_lock);
+	memset(&sim, 0, sizeof(sim));
+	sim.time = time - 1;
+	sim_frame();
+}
+
+/* Makes count frames, the device running ahead of the producer */
+static void sim_frames(uint32_t count)
+{
+	std::lock_guard<std::mutex> bus(sim_lock);
+	while (count--)
+		sim_frame();
+}
+
+static uint32_t sim_read32(void * addr)
+{
+	std::lock_guard<std::mutex> bus(sim_lock);
+	uint32_t v;
+
+	memcpy(&v, &sim.regs[(uint8_t *) addr - sim.regs], 4);
+	return v;
+}
+
+static uint8_t sim_read8(void * addr)
+{
+	std::lock_guard<std::mutex> bus(sim_lock);
+	return sim.regs[(uint8_t *) addr - sim.regs];
+}
+
+static void sim_write8(uint8_t val, void * addr)
+{
+	std::lock_guard<std::mutex> bus(sim_lock);
+	if ((size_t) ((uint8_t *) addr - sim.regs) != READING(0))
+		return;
+	sim.reading = val & 1;
+	if (sim.reading) {
+		sim.regs[VALID(0)] = 1;
+		if (sim.tear || sim.tear_all) {
+			sim.tear = false;
+			sim_frame();
+		}
+	}
+}
+
+/* The driver's state, with a mutex and condition for its wait queue */
+static struct fft_accelerator_reader reader;
+static fft_accelerator_ring_t ring;
+static fft_accelerator_fft_t spare;
+static std::mutex wait_lock;
+static std::condition_variable wait_queue;
+
+/* A producer tick, as fft_accelerator_tick() does it */
+static void tick()
+{
+	if (fft_accelerator_produce(sim.regs, &reader, &ring, &spare)) {
+		std::lock_guard<std::mutex> lock(wait_lock);
+		wait_queue.notify_all();
+	}
+}
+
+/* Takes up to count frames, checking each slot holds the frame numbered */
+static uint32_t take(fft_accelerator_fft_t * out, uint32_t count, bool * numbered)
+{
+	fft_accelerator_slot_t * slot;
+	uint32_t n;
+
+	for (n = 0; n < count && (slot = fft_ring_peek(&ring)); n++) {
+		*numbered &= slot->seq == ring.tail + 1;
+		out[n] = slot->frame;
+		fft_ring_release(&ring);
+	}
+	return n;
+}
+
+/* Starts a capture at frame time with frame number head next in the ring */
+static void restart(uint32_t time, uint32_t head)
+{
+	sim_reset(time);
+	reader.primed = 0;
+	fft_ring_init(&ring, head);
+}
+
+static int failed = 0;
+
+static void check(bool ok, const char * what)
+{
+	std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+	failed |= !ok;
+}
+
+/* Every frame whole, and each step after the last if step isn't 0 */
+static bool consistent(const fft_accelerator_fft_t * frames, uint32_t count,
+	uint32_t step)
+{
+	for (uint32_t n = 0; n < count; n++) {
+		if (!frames[n].valid || (n && step
+			&& frames[n].time - frames[n - 1].time != step))
+			return false;
+		if (n && (int32_t) (frames[n].time - frames[n - 1].time) <= 0)
+			return false;
+		for (int i = 0; i < N_FREQUENCIES; i++)
+			if (frames[n].fft[i] != amplitude(frames[n].time, i))
+				return false;
+	}
+	return true;
+}
+
+/*
+ * A second of frames made by one thread every 2 ms, published by another
+ * ticking every 1 ms and taken in place by a third sleeping until there
+ * is one, like a reader of the mapped ring in poll(). Every frame made
+ * must be taken or counted as missed.
+ */
+static void run_threads()
+{
+	const uint32_t made = 500;
+	std::vector<fft_accelerator_fft_t> taken(made);
+	uint32_t count = 0;
+	uint32_t wakeups = 0;
+	bool numbered = true;
+	bool done = false;
+
+	restart(1000, 0xFFFFFF00u);
+	std::thread fpga([&] {
+		for (uint32_t n = 1; n < made; n++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			sim_frames(1);
+		}
+	});
+	std::thread producer([&] {
+		while (!done) {
+			tick();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(wait_lock);
+			if (!wait_queue.wait_for(lock, std::chrono::milliseconds(100),
+				[] { return fft_ring_peek(&ring) != NULL; }))
+				break;	/* the device stopped */
+		}
+		wakeups++;
+		count += take(&taken[count], made - count, &numbered);
+	}
+	fpga.join();
+	done = true;
+	producer.join();
+
+	uint32_t span = count ? taken[count - 1].time - taken[0].time + 1 : 0;
+	std::cout << "threads: " << count << " frames taken, " << ring.missed
+		<< " missed, in " << wakeups << " wakeups" << std::endl;
+	check(count > made / 2 && taken[0].time == 1000 && count + ring.missed == span
+		&& span == made && numbered && consistent(&taken[0], count, 0),
+		"takes or counts every frame made by a device on another thread");
+}
+
+/* A ring in file, for fft_capture to map the way it maps the driver's */
+static fft_accelerator_ring_t * map_ring(FILE * file)
+{
+	void * p;
+
+	if (!file || ftruncate(fileno(file), sizeof(fft_accelerator_ring_t))) {
+		check(false, "makes a file to map");
+		return NULL;
+	}
+	p = mmap(NULL, sizeof(fft_accelerator_ring_t), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fileno(file), 0);
+	if (p == MAP_FAILED) {
+		check(false, "maps the file");
+		return NULL;
+	}
+	return (fft_accelerator_ring_t *) p;
+}
+
+/*
+ * fft_capture on a mapped ring, with frames published before it starts
+ * and between its reads
+ */
+static void run_capture()
+{
+	FILE * file = tmpfile();
+	fft_accelerator_ring_t * mapped = map_ring(file);
+	fft_capture capture;
+	const fft_accelerator_fft_t * frame;
+	bool ok = true;
+
+	if (!mapped)
+		return;
+
+	restart(50, 0);
+	fft_ring_init(mapped, 0);
+	for (int n = 0; n < 5; n++) {
+		sim_frames(1);
+		fft_accelerator_produce(sim.regs, &reader, mapped, &spare);
+	}
+	capture.restart();
+
+	/* the first frame after the restart, once the capture has dropped the rest */
+	std::thread producer([&] {
+		while (fft_ring_load(&mapped->tail) != 5)
+			std::this_thread::yield();
+		sim_frames(1);
+		fft_accelerator_produce(sim.regs, &reader, mapped, &spare);
+	});
+	frame = capture.read(fileno(file));
+	producer.join();
+	ok &= frame && frame->time == 56;
+
+	for (int n = 0; n < 200; n++) {
+		if (n % 3 == 0)
+			sim_frames(2);	/* one each third read is missed */
+		else
+			sim_frames(1);
+		fft_accelerator_produce(sim.regs, &reader, mapped, &spare);
+		frame = capture.read(fileno(file));
+		ok &= frame && frame->valid && frame->fft[7] == amplitude(frame->time, 7);
+	}
+	/* the frame handed out is the one in the ring, not a copy */
+	mapped->slot[mapped->tail % FFT_RING_SLOTS].frame.fft[0] = 12345;
+	ok &= frame && frame->fft[0] == 12345;
+	check(ok && frame && frame->time == 56 + 200 + 67 && capture.missed() == 67
+		&& mapped->tail == mapped->head - 1,
+		"reads the mapped ring in place from where it restarted");
+
+	munmap(mapped, sizeof(*mapped));
+	fclose(file);
+}
+
+/* Publishes frames frames in ring, one a tick, waiting for room */
+static void publish_frames(fft_accelerator_ring_t * ring, uint32_t frames)
+{
+	for (uint32_t n = 0; n < frames; n++) {
+		while (!fft_ring_next(ring))
+			std::this_thread::yield();
+		sim_frames(1);
+		fft_accelerator_produce(sim.regs, &reader, ring, &spare);
+	}
+}
+
+/* Whether frame holds the magnitudes of the frame the device made at its time */
+static bool captured(const captured_frame * frame)
+{
+	for (int i = 0; i < SPECTROGRAM_WIDTH; i++)
+		if (frame->magnitude[i] != std::abs((float) amplitude(frame->time, i))
+				/ (1 << AMPL_FRACTIONAL_BITS))
+			return false;
+	return true;
+}
+
+/*
+ * Starts capture on a ring in file of frames frames, from the frame after
+ * 10, with a frame published before it that it has to drop
+ */
+static void start_capture(capture_thread & capture, FILE * file,
+	fft_accelerator_ring_t * ring, uint32_t frames)
+{
+	restart(10, 0);
+	fft_ring_init(ring, 0);
+	publish_frames(ring, 1);
+	capture.start(fileno(file), frames);
+	while (fft_ring_load(&ring->tail) != 1)
+		std::this_thread::yield();
+}
+
+/*
+ * capture_thread on a mapped ring: first with nothing taking its frames
+ * until the recording is over, so its queue fills and drops the rest,
+ * then with the frames taken while it records
+ */
+static void run_capture_thread()
+{
+	const uint32_t made = 3000;
+	FILE * file = tmpfile();
+	fft_accelerator_ring_t * mapped = map_ring(file);
+	capture_thread capture;
+	const captured_frame * frame;
+	uint32_t taken;
+	uint32_t prev;
+	bool ok;
+
+	if (!mapped)
+		return;
+
+	start_capture(capture, file, mapped, made);
+	publish_frames(mapped, made);
+	while (capture.queued() + capture.dropped() < made)
+		std::this_thread::yield();
+	ok = capture.peak_queued() == CAPTURE_QUEUE_FRAMES
+		&& capture.dropped() == made - CAPTURE_QUEUE_FRAMES;
+	for (taken = 0; (frame = capture.next()); taken++) {
+		ok &= frame->time == 12 + taken && captured(frame);
+		capture.pop();
+	}
+	check(ok && taken == CAPTURE_QUEUE_FRAMES && !capture.failed()
+		&& capture.missed() == 0,
+		"queues frames until full, then counts the rest as dropped");
+
+	start_capture(capture, file, mapped, made);
+	std::thread device([&] { publish_frames(mapped, made); });
+	ok = true;
+	prev = 11;
+	for (taken = 0; (frame = capture.next()); taken++) {
+		ok &= (int32_t) (frame->time - prev) > 0 && captured(frame);
+		prev = frame->time;
+		capture.pop();
+	}
+	device.join();
+	std::cout << "capture thread: " << taken << " frames taken, "
+		<< capture.dropped() << " dropped, at most " << capture.peak_queued()
+		<< " queued" << std::endl;
+	check(ok && taken + capture.dropped() == made && prev == 11 + made
+		&& capture.queued() == 0,
+		"takes or counts as dropped every frame while recording");
+
+	munmap(mapped, sizeof(*mapped));
+	fclose(file);
+}
+
+/* The magnitudes capture_thread makes of the frame at time */
+static void magnitudes(uint32_t time, float * out)
+{
+	for (int i = 0; i < SPECTROGRAM_WIDTH; i++)
+		out[i] = std::abs((float) amplitude(time, i)) / (1 << AMPL_FRACTIONAL_BITS);
+}
+
+typedef std::set<std::pair<uint16_t, fingerprint_key> > print_set;
+
+/* Fingerprints of frames from first to last, all there */
+static print_set reference_prints(uint32_t first, uint32_t last)
+{
+	frame_fingerprinter fingerprinter;
+	std::vector<fingerprint_record> prints;
+	print_set all;
+	float frame[SPECTROGRAM_WIDTH];
+
+	for (uint32_t time = first; time != last + 1; time++) {
+		magnitudes(time, frame);
+		fingerprinter.push(frame, prints);
+		for (size_t k = 0; k < prints.size(); k++)
+			all.insert(std::make_pair(prints[k].time, prints[k].hash));
+	}
+	fingerprinter.flush(prints);
+	for (size_t k = 0; k < prints.size(); k++)
+		all.insert(std::make_pair(prints[k].time, prints[k].hash));
+	return all;
+}
+
+/* Share of prints in all */
+static float found_in(const std::vector<fingerprint_record> & prints,
+	const print_set & all)
+{
+	size_t found = 0;
+
+	for (size_t k = 0; k < prints.size(); k++)
+		found += all.count(std::make_pair(prints[k].time, prints[k].hash));
+	return prints.empty() ? 0 : (float) found / prints.size();
+}
+
+/*
+ * A device that drops a few frames every so often, and once more than a
+ * pruning window of them, read by a capture_thread whose consumer stalls
+ * once long enough for the queue to drop frames too. Every frame lost
+ * must show as a gap, and the fingerprints taken across the gaps must
+ * keep their true times, as fingerprints of the same audio all there do;
+ * none may pair peaks from either side of a gap.
+ */
+static void run_gaps()
+{
+	const uint32_t made = 4000;
+	FILE * file = tmpfile();
+	fft_accelerator_ring_t * mapped = map_ring(file);
+	capture_thread capture;
+	frame_fingerprinter fingerprinter;
+	std::vector<fingerprint_record> prints;
+	std::vector<fingerprint_record> recording;
+	std::vector<uint32_t> times;	/* of the frames taken */
+	std::vector<bool> lost;		/* by time from the first frame taken */
+	const captured_frame * frame;
+	uint32_t injected = 0;
+	uint32_t gaps = 0;
+	bool ok = true;
+
+	if (!mapped)
+		return;
+
+	start_capture(capture, file, mapped, made);
+	std::thread device([&] {
+		uint32_t seed = 1;
+		for (uint32_t n = 0; n < made; n++) {
+			uint32_t skip = 0;
+			seed = seed * 1103515245u + 12345u;
+			if (n == made / 2)
+				skip = PRUNING_TIME_WINDOW + 100;
+			else if (n && (seed >> 16) % 100 == 0)
+				skip = 1 + (seed >> 8) % 8;
+			injected += skip;
+			gaps += skip != 0;
+			while (!fft_ring_next(mapped))
+				std::this_thread::yield();
+			sim_frames(1 + skip);
+			fft_accelerator_produce(sim.regs, &reader, mapped, &spare);
+		}
+	});
+	while ((frame = capture.next())) {
+		ok &= frame->gap == (times.empty() ? 0 : frame->time - times.back() - 1)
+			&& captured(frame);
+		times.push_back(frame->time);
+		fingerprinter.skip(frame->gap);
+		fingerprinter.push(frame->magnitude, prints);
+		recording.insert(recording.end(), prints.begin(), prints.end());
+		capture.pop();
+		if (times.size() == made / 4)
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	device.join();
+	fingerprinter.flush(prints);
+	recording.insert(recording.end(), prints.begin(), prints.end());
+
+	uint32_t first = times.front();
+	uint32_t span = times.back() - first + 1;
+	std::cout << "gaps: " << times.size() << " frames taken, " << capture.lost()
+		<< " lost in " << capture.gaps() << " gaps, " << injected << " by the device in "
+		<< gaps << ", " << capture.dropped() << " dropped" << std::endl;
+	check(ok && times.size() + capture.lost() == span && capture.missed() == injected
+		&& capture.lost() == injected + capture.dropped() && capture.gaps() > 0
+		&& capture.gaps() <= gaps + capture.dropped(),
+		"shows every frame lost as a gap before the next frame");
+	check(fingerprinter.frame_count() == span
+		&& fingerprinter.skipped_count() == capture.lost(),
+		"moves time on over the gaps");
+
+	lost.assign(span, true);
+	for (size_t k = 0; k < times.size(); k++)
+		lost[times[k] - first] = false;
+	bool apart = true;
+	for (size_t k = 0; k < recording.size(); k++) {
+		uint32_t anchor = recording[k].time;
+		uint32_t target = anchor + (recording[k].hash & HASH_DELTA_MAX);
+		for (uint32_t t = anchor; t <= target && apart; t++)
+			apart = t < span && !lost[t];
+	}
+	check(apart, "pairs no peaks across a gap");
+
+	/* the same frames fingerprinted as if none were lost */
+	frame_fingerprinter naive;
+	std::vector<fingerprint_record> shifted;
+	float magnitude[SPECTROGRAM_WIDTH];
+	for (size_t k = 0; k < times.size(); k++) {
+		magnitudes(times[k], magnitude);
+		naive.push(magnitude, prints);
+		shifted.insert(shifted.end(), prints.begin(), prints.end());
+	}
+	naive.flush(prints);
+	shifted.insert(shifted.end(), prints.begin(), prints.end());
+
+	print_set all = reference_prints(first, times.back());
+	float kept = found_in(recording, all);
+	float naive_kept = found_in(shifted, all);
+	std::cout << "gaps: " << 100 * kept << "% of " << recording.size()
+		<< " fingerprints true, " << 100 * naive_kept << "% of " << shifted.size()
+		<< " ignoring the gaps" << std::endl;
+	check(kept > 0.6f && kept > 2 * naive_kept,
+		"keeps fingerprints true across the gaps");
+
+	munmap(mapped, sizeof(*mapped));
+	fclose(file);
+}
+
+/*
+ * A gap too long for 16 bit times to order, after which the fingerprinter
+ * starts over, keeping true times on both sides of it
+ */
+static void run_long_gap()
+{
+	const uint32_t before = 3000;
+	const uint32_t gap = 18000;	/* the pruning windows stay where they were */
+	const uint32_t after = 3000;
+	frame_fingerprinter fingerprinter;
+	std::vector<fingerprint_record> prints;
+	std::vector<fingerprint_record> recording;
+	float frame[SPECTROGRAM_WIDTH];
+	bool apart = true;
+	size_t early = 0;
+
+	for (uint32_t time = 0; time < before + gap + after; time++) {
+		if (time == before)
+			fingerprinter.skip(gap);
+		if (time >= before && time < before + gap)
+			continue;
+		magnitudes(time, frame);
+		fingerprinter.push(frame, prints);
+		recording.insert(recording.end(), prints.begin(), prints.end());
+	}
+	fingerprinter.flush(prints);
+	recording.insert(recording.end(), prints.begin(), prints.end());
+
+	for (size_t k = 0; k < recording.size(); k++) {
+		uint32_t target = recording[k].time + (recording[k].hash & HASH_DELTA_MAX);
+		early += recording[k].time < before;
+		apart &= recording[k].time < before ? target < before : recording[k].time >= before + gap;
+	}
+	float kept = found_in(recording, reference_prints(0, before + gap + after - 1));
+	check(gap >= frame_fingerprinter::LONG_GAP && apart && early
+		&& early < recording.size() && kept > 0.6f,
+		"starts over after a gap too long for 16 bit times");
+}
+
+int main()
+{
+	static fft_accelerator_fft_t frames[FFT_RING_SLOTS + 1];
+	bool numbered = true;
+	uint32_t got;
+
+	restart(1, 0);
+	for (int n = 0; n < 40; n++) {
+		tick();
+		tick();
+		sim_frames(1);
+	}
+	got = take(frames, FFT_RING_SLOTS, &numbered);
+	check(got == 40 && ring.missed == 0 && numbered && consistent(frames, got, 1),
+		"publishes every frame once when ticking twice a frame");
+	check(!fft_ring_peek(&ring), "has nothing more to take");
+	tick();
+	got = take(frames, FFT_RING_SLOTS, &numbered);
+	check(got == 1 && frames[0].time == 41, "carries on after the ring empties");
+
+	restart(100, 0);
+	for (int n = 0; n < 10; n++) {
+		tick();
+		sim_frames(3);
+	}
+	got = take(frames, FFT_RING_SLOTS, &numbered);
+	check(got == 10 && ring.missed == 18 && consistent(frames, got, 3),
+		"counts the frames made between ticks as missed");
+
+	restart(5, 0);
+	tick();
+	sim.tear = true;
+	sim_frames(1);
+	tick();
+	got = take(frames, FFT_RING_SLOTS, &numbered);
+	check(got == 2 && ring.missed == 1 && frames[1].time == 7
+		&& consistent(frames, got, 2), "reads a torn frame again");
+
+	restart(5, 0);
+	tick();
+	sim.tear_all = true;
+	sim_frames(1);
+	tick();
+	check(ring.head == 1, "publishes nothing while every read is torn");
+
+	restart(0xFFFFFFF0u, 0xFFFFFFF8u);
+	for (int n = 0; n < 32; n++) {
+		tick();
+		sim_frames(1);
+	}
+	got = take(frames, FFT_RING_SLOTS, &numbered);
+	check(got == 32 && ring.missed == 0 && numbered && consistent(frames, got, 1),
+		"follows the time counter and frame numbers across their wraps");
+
+	restart(1, 0);
+	for (int n = 0; n < FFT_RING_SLOTS + 10; n++) {
+		tick();
+		sim_frames(1);
+	}
+	check(ring.head == FFT_RING_SLOTS && ring.missed == 10,
+		"keeps its frames when full, counting new ones as missed");
+	got = take(frames, FFT_RING_SLOTS, &numbered);
+	tick();
+	got += take(&frames[got], 1, &numbered);
+	check(got == FFT_RING_SLOTS + 1 && ring.missed == 10 && frames[0].time == 1
+		&& frames[got - 1].time == FFT_RING_SLOTS + 11 && numbered
+		&& consistent(frames, FFT_RING_SLOTS, 1),
+		"carries on with the newest frame once there is room");
+	check(!fft_ring_peek(&ring), "doesn't take a slot from an earlier lap");
+
+	for (int n = 0; n < 20; n++) {
+		sim_frames(1);
+		tick();
+	}
+	fft_ring_restart(&ring);
+	sim_frames(1);
+	tick();
+	got = take(frames, FFT_RING_SLOTS, &numbered);
+	check(got == 1 && frames[0].time == FFT_RING_SLOTS + 32 && numbered,
+		"drops the frames published before a restart");
+
+	sim_frames(100);
+	reader.primed = 0;
+	ring.missed = 0;
+	tick();
+	sim_frames(1);
+	tick();
+	got = take(frames, FFT_RING_SLOTS, &numbered);
+	check(got == 2 && ring.missed == 0 && consistent(frames, got, 1),
+		"doesn't count frames before the producer restarts as missed");
+
+	run_threads();
+	run_capture();
+	run_capture_thread();
+	run_gaps();
+	run_long_gap();
+	return failed;
+}